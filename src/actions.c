@@ -20,6 +20,7 @@
 #endif
 
 #include <X11/Xlib.h>
+#include <X11/Xatom.h>
 #include <X11/extensions/XTest.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -31,7 +32,8 @@
 /* Actions */
 const char * action_name[ACTION_COUNT] = {
 		"ERROR", "EXIT_GEST", "EXECUTE", "ICONIFY", "KILL", "RECONF", "RAISE", "LOWER", "MAXIMIZE",
-		"RESTORE", "TOGGLE_MAXIMIZED", "KEYPRESS", "ABORT", "LAST" };
+		"RESTORE", "TOGGLE_MAXIMIZED", "KEYPRESS", "ABORT", "TOGGLE_FULLSCREEN", "TOGGLE_STICKY",
+		"TOGGLE_ABOVE", "TOGGLE_BELOW", "NEXT_DESKTOP", "PREVIOUS_DESKTOP", "DESKTOP", "LAST" };
 
 const char * get_action_name(int action) {
 	return action_name[action];
@@ -65,9 +67,7 @@ void action_kill(Display *dpy, Window w) {
 	if (w == RootWindow(dpy, DefaultScreen(dpy)))
 		return;
 
-	XSync(dpy, 0);
 	XKillClient(dpy, w);
-	XSync(dpy, 0);
 	return;
 }
 
@@ -91,12 +91,47 @@ void action_lower(Display *dpy, Window w) {
 	return;
 }
 
+/*
+ * Atoms used by the window management actions. Interned once per display.
+ */
+static char * atom_names[ATOM_COUNT] = {
+		"_NET_WM_STATE", "_NET_WM_STATE_MAXIMIZED_HORZ",
+		"_NET_WM_STATE_MAXIMIZED_VERT", "_NET_WM_STATE_FULLSCREEN",
+		"_NET_WM_STATE_STICKY", "_NET_WM_STATE_ABOVE", "_NET_WM_STATE_BELOW",
+		"_NET_CURRENT_DESKTOP", "_NET_NUMBER_OF_DESKTOPS" };
+
+static Atom atoms[ATOM_COUNT];
+static Display *atoms_display = NULL;
+
+/**
+ * Intern all atoms with a single request.
+ *
+ * PUBLIC
+ */
+void actions_init(Display *dpy) {
+
+	if (atoms_display == dpy) {
+		return;
+	}
+
+	if (!XInternAtoms(dpy, atom_names, ATOM_COUNT, False, atoms)) {
+		fprintf(stderr, "Cannot intern window manager atoms.\n");
+	}
+
+	atoms_display = dpy;
+}
+
+static Atom get_atom(Display *dpy, int atom) {
+	actions_init(dpy);
+	return atoms[atom];
+}
+
 /*
  * Taken from wmctrl
  */
 static int client_msg(	Display *disp,
 						Window win,
-						char *msg,
+						int msg,
 						unsigned long data0,
 						unsigned long data1,
 						unsigned long data2,
@@ -108,7 +143,7 @@ static int client_msg(	Display *disp,
 	event.xclient.type = ClientMessage;
 	event.xclient.serial = 0;
 	event.xclient.send_event = True;
-	event.xclient.message_type = XInternAtom(disp, msg, False);
+	event.xclient.message_type = get_atom(disp, msg);
 	event.xclient.window = win;
 	event.xclient.format = 32;
 	event.xclient.data.l[0] = data0;
@@ -120,12 +155,22 @@ static int client_msg(	Display *disp,
 	if (XSendEvent(disp, DefaultRootWindow(disp), False, mask, &event)) {
 		return EXIT_SUCCESS;
 	} else {
-		fprintf(stderr, "Cannot send %s event.\n", msg);
+		fprintf(stderr, "Cannot send %s event.\n", atom_names[msg]);
 		return EXIT_FAILURE;
 	}
 
-	XFlush(disp);
+}
+
+/*
+ * Ask the window manager to change up to two _NET_WM_STATE properties.
+ */
+static void set_wm_state(Display *dpy, Window w, unsigned long action,
+		int prop1, int prop2) {
+
+	Atom atom2 = (prop2 < 0) ? 0 : get_atom(dpy, prop2);
 
+	client_msg(dpy, w, ATOM__NET_WM_STATE, action,
+			(unsigned long) get_atom(dpy, prop1), (unsigned long) atom2, 0, 0);
 }
 
 /**
@@ -134,22 +179,8 @@ static int client_msg(	Display *disp,
  * PUBLIC
  */
 void action_toggle_maximized(Display *dpy, Window w) {
-
-	unsigned long action;
-	Atom prop1 = 0;
-	Atom prop2 = 0;
-
-	action = _NET_WM_STATE_TOGGLE;
-
-	char *tmp_prop2, *tmp2;
-	tmp_prop2 = "_NET_WM_STATE_MAXIMIZED_HORZ";
-	prop2 = XInternAtom(dpy, tmp_prop2, False);
-	char * tmp_prop1 = "_NET_WM_STATE_MAXIMIZED_VERT";
-
-	prop1 = XInternAtom(dpy, tmp_prop1, False);
-
-	client_msg(dpy, w, "_NET_WM_STATE", action, (unsigned long) prop1, (unsigned long) prop2, 0, 0);
-
+	set_wm_state(dpy, w, _NET_WM_STATE_TOGGLE,
+			ATOM__NET_WM_STATE_MAXIMIZED_VERT, ATOM__NET_WM_STATE_MAXIMIZED_HORZ);
 }
 
 /**
@@ -158,127 +189,213 @@ void action_toggle_maximized(Display *dpy, Window w) {
  * PUBLIC
  */
 void action_restore(Display *dpy, Window w) {
+	set_wm_state(dpy, w, _NET_WM_STATE_REMOVE,
+			ATOM__NET_WM_STATE_MAXIMIZED_VERT, ATOM__NET_WM_STATE_MAXIMIZED_HORZ);
+}
 
-	unsigned long action;
-	Atom prop1 = 0;
-	Atom prop2 = 0;
-
-	action = _NET_WM_STATE_REMOVE;
-
-	char *tmp_prop2, *tmp2;
-	tmp_prop2 = "_NET_WM_STATE_MAXIMIZED_HORZ";
-	prop2 = XInternAtom(dpy, tmp_prop2, False);
-	char * tmp_prop1 = "_NET_WM_STATE_MAXIMIZED_VERT";
-
-	prop1 = XInternAtom(dpy, tmp_prop1, False);
+/**
+ * Maximize the focused window at the given Display.
+ *
+ * PUBLIC
+ */
+void action_maximize(Display *dpy, Window w) {
+	set_wm_state(dpy, w, _NET_WM_STATE_ADD,
+			ATOM__NET_WM_STATE_MAXIMIZED_VERT, ATOM__NET_WM_STATE_MAXIMIZED_HORZ);
+}
 
-	client_msg(dpy, w, "_NET_WM_STATE", action, (unsigned long) prop1, (unsigned long) prop2, 0, 0);
+/**
+ * Toggle the fullscreen state of the focused window.
+ *
+ * PUBLIC
+ */
+void action_toggle_fullscreen(Display *dpy, Window w) {
+	set_wm_state(dpy, w, _NET_WM_STATE_TOGGLE, ATOM__NET_WM_STATE_FULLSCREEN,
+			-1);
+}
 
+/**
+ * Show or stop showing the focused window on all desktops.
+ *
+ * PUBLIC
+ */
+void action_toggle_sticky(Display *dpy, Window w) {
+	set_wm_state(dpy, w, _NET_WM_STATE_TOGGLE, ATOM__NET_WM_STATE_STICKY, -1);
 }
 
 /**
- * Maximize the focused window at the given Display.
+ * Keep the focused window above the others.
  *
  * PUBLIC
  */
-void action_maximize(Display *dpy, Window w) {
+void action_toggle_above(Display *dpy, Window w) {
+	set_wm_state(dpy, w, _NET_WM_STATE_TOGGLE, ATOM__NET_WM_STATE_ABOVE, -1);
+}
 
-	unsigned long action;
-	Atom prop1 = 0;
-	Atom prop2 = 0;
+/**
+ * Keep the focused window below the others.
+ *
+ * PUBLIC
+ */
+void action_toggle_below(Display *dpy, Window w) {
+	set_wm_state(dpy, w, _NET_WM_STATE_TOGGLE, ATOM__NET_WM_STATE_BELOW, -1);
+}
 
-	action = _NET_WM_STATE_ADD;
+static long get_root_cardinal(Display *dpy, int atom) {
 
-	char *tmp_prop2, *tmp2;
-	tmp_prop2 = "_NET_WM_STATE_MAXIMIZED_HORZ";
-	prop2 = XInternAtom(dpy, tmp_prop2, False);
-	char * tmp_prop1 = "_NET_WM_STATE_MAXIMIZED_VERT";
+	Atom type;
+	int format;
+	unsigned long nitems, bytes_after;
+	unsigned char *data = NULL;
+	long value = -1;
 
-	prop1 = XInternAtom(dpy, tmp_prop1, False);
+	if (XGetWindowProperty(dpy, DefaultRootWindow(dpy), get_atom(dpy, atom), 0,
+			1, False, XA_CARDINAL, &type, &format, &nitems, &bytes_after,
+			&data) == Success && data) {
+		if (nitems == 1 && format == 32) {
+			value = *(long *) data;
+		}
+		XFree(data);
+	}
 
-	client_msg(dpy, w, "_NET_WM_STATE", action, (unsigned long) prop1, (unsigned long) prop2, 0, 0);
+	return value;
+}
 
+/**
+ * Switch to a desktop, counting from 0.
+ *
+ * PUBLIC
+ */
+void action_desktop(Display *dpy, long desktop) {
+	client_msg(dpy, DefaultRootWindow(dpy), ATOM__NET_CURRENT_DESKTOP,
+			(unsigned long) desktop, CurrentTime, 0, 0, 0);
 }
 
 /**
- * Fake key event
+ * Move 'offset' desktops away from the current one, wrapping around.
+ *
+ * PUBLIC
  */
-void press_key(Display *dpy, KeySym key, Bool is_press) {
+void action_desktop_offset(Display *dpy, int offset) {
 
-	XTestFakeKeyEvent(dpy, XKeysymToKeycode(dpy, key), is_press, CurrentTime);
-	return;
-}
+	long current = get_root_cardinal(dpy, ATOM__NET_CURRENT_DESKTOP);
+	long count = get_root_cardinal(dpy, ATOM__NET_NUMBER_OF_DESKTOPS);
+
+	if (current < 0 || count <= 0) {
+		fprintf(stderr, "The window manager doesn't report its desktops.\n");
+		return;
+	}
 
-/* alloc a key_press struct ???? */
-struct key_press * alloc_key_press(void) {
-	struct key_press *ans = malloc(sizeof(struct key_press));
-	bzero(ans, sizeof(struct key_press));
-	return ans;
+	action_desktop(dpy, ((current + offset) % count + count) % count);
 }
 
+/* bumped whenever the keyboard mapping changes, see actions_mapping_notify */
+static int keymap_serial = 1;
+
 /**
- * Creates a Keysym from a char sequence
+ * Parse the keys of a KEYPRESS action, like "Control_L+Shift_L+T".
  *
- * PRIVATE
+ * Keycodes depend on the display, so they are resolved on the first press.
+ * The key lists are allocated from 'arena'.
  */
-struct key_press * string_to_keypress(char *str_ptr) {
+int action_keypress_compile(Action *action, Arena *arena) {
 
-	char * copy = strdup(str_ptr);
+	const char * delimiters = "+\n ";
 
-	struct key_press base;
-	struct key_press *key;
-	KeySym k;
-	char *str = copy;
-	char *token = str;
-	char *str_dup;
+	char * copy = strdup(action->original_str);
+	char * str = copy;
+	char * token;
+	int count = 0;
 
-	if (str == NULL)
-		return NULL;
+	/* count the keys first, so they fit a single array */
+	for (char * c = copy; *c; ++c) {
+		if (!strchr(delimiters, *c) && (c == copy || strchr(delimiters, c[-1]))) {
+			count++;
+		}
+	}
+
+	action->keysym_list = arena_alloc(arena, sizeof(KeySym) * (count + 1));
+	action->keycode_list = arena_alloc(arena, sizeof(KeyCode) * (count + 1));
+	action->key_count = 0;
+	action->keymap_serial = 0;
+
+	while ((token = strsep(&str, delimiters)) != NULL) {
+
+		if (!*token) {
+			continue;
+		}
 
-	key = &base;
-	token = strsep(&copy, "+\n ");
-	while (token != NULL) {
-		/* printf("found : %s\n", token); */
-		k = XStringToKeysym(token);
+		KeySym k = XStringToKeysym(token);
 		if (k == NoSymbol) {
 			fprintf(stderr, "error converting %s to keysym\n", token);
-			exit(-1);
+			action->key_count = 0;
+			free(copy);
+			return 1;
+		}
+		action->keysym_list[action->key_count++] = k;
+	}
+
+	free(copy);
+	return 0;
+}
+
+static void action_keypress_resolve(Display *dpy, Action *action) {
+
+	int i;
+
+	for (i = 0; i < action->key_count; ++i) {
+		action->keycode_list[i] = XKeysymToKeycode(dpy, action->keysym_list[i]);
+		if (!action->keycode_list[i]) {
+			fprintf(stderr, "no keycode for %s on the current keymap\n",
+					XKeysymToString(action->keysym_list[i]));
 		}
-		key->next = alloc_key_press();
-		key = key->next;
-		key->key = k;
-		token = strsep(&copy, "+\n ");
 	}
 
-	base.next->original_str = str_ptr;
-	return base.next;
+	action->keymap_serial = keymap_serial;
 }
 
 /**
- * Fake sequence key events
+ * Keyboard mapping changed. Keycodes will be resolved again on the next press.
  */
-void action_keypress(Display *dpy, char *data) {
+void actions_mapping_notify(XMappingEvent *event) {
+
+	XRefreshKeyboardMapping(event);
 
-	struct key_press * keys = string_to_keypress(data);
+	if (event->request != MappingPointer) {
+		keymap_serial++;
+	}
+}
 
-	struct key_press *first_key;
-	struct key_press *tmp;
+/**
+ * Fake sequence key events. With a key delay, the server waits that many
+ * milliseconds before each event after the first one.
+ */
+void action_keypress(Display *dpy, Action *action) {
 
-	first_key = (struct key_press *) keys;
+	int i;
 
-	if (first_key == NULL) {
-		fprintf(stderr, " internal error in %s, key is null\n", __func__);
+	if (action->key_count == 0) {
+		fprintf(stderr, " no keys to press in '%s'\n", action->original_str);
 		return;
 	}
 
-	for (tmp = first_key; tmp != NULL; tmp = tmp->next) {
-		press_key(dpy, tmp->key, True);
+	if (action->keymap_serial != keymap_serial) {
+		action_keypress_resolve(dpy, action);
 	}
 
-	for (tmp = first_key; tmp != NULL; tmp = tmp->next) {
-		press_key(dpy, tmp->key, False);
+	unsigned long delay = CurrentTime;
+
+	for (i = 0; i < action->key_count; ++i) {
+		if (action->keycode_list[i]) {
+			XTestFakeKeyEvent(dpy, action->keycode_list[i], True, delay);
+			delay = action->key_delay;
+		}
+	}
+
+	for (i = 0; i < action->key_count; ++i) {
+		if (action->keycode_list[i]) {
+			XTestFakeKeyEvent(dpy, action->keycode_list[i], False, delay);
+		}
 	}
 
 	return;
 }
-
@@ -20,9 +20,15 @@
 
 #include <X11/Xlib.h>
 
-#define ACTION_COUNT 14
+#include "configuration.h"
 
-/* Actions */
+#define ACTION_COUNT 21
+
+/*
+ * Actions. The numbers are stored in the configuration cache, which is only
+ * read back with the same ACTION_COUNT: bump CACHE_VERSION in
+ * configuration_cache.c if they change in any other way.
+ */
 enum {
 	ACTION_NULL,
 	ACTION_EXIT_GEST,
@@ -37,17 +43,34 @@ enum {
 	ACTION_TOGGLE_MAXIMIZED,
 	ACTION_KEYPRESS,
 	ACTION_ABORT,
+	ACTION_TOGGLE_FULLSCREEN,
+	ACTION_TOGGLE_STICKY,
+	ACTION_TOGGLE_ABOVE,
+	ACTION_TOGGLE_BELOW,
+	ACTION_NEXT_DESKTOP,
+	ACTION_PREVIOUS_DESKTOP,
+	ACTION_DESKTOP,
 	ACTION_LAST
 };
 
-struct key_press {
-	KeySym key;
-	struct key_press * next;
-	char *original_str;
+/* Atoms used by the actions, see actions_init */
+enum {
+	ATOM__NET_WM_STATE,
+	ATOM__NET_WM_STATE_MAXIMIZED_HORZ,
+	ATOM__NET_WM_STATE_MAXIMIZED_VERT,
+	ATOM__NET_WM_STATE_FULLSCREEN,
+	ATOM__NET_WM_STATE_STICKY,
+	ATOM__NET_WM_STATE_ABOVE,
+	ATOM__NET_WM_STATE_BELOW,
+	ATOM__NET_CURRENT_DESKTOP,
+	ATOM__NET_NUMBER_OF_DESKTOPS,
+	ATOM_COUNT
 };
 
 const char * get_action_name(int action);
 
+void actions_init(Display *dpy);
+
 void action_iconify(Display *dpy, Window w);
 void action_kill(Display *dpy, Window w);
 void action_raise(Display *dpy, Window w);
@@ -55,6 +78,14 @@ void action_lower(Display *dpy, Window w);
 void action_maximize(Display *dpy, Window w);
 void action_restore(Display *dpy, Window w);
 void action_toggle_maximized(Display *dpy, Window w);
-void action_keypress(Display *dpy, char *data);
+void action_toggle_fullscreen(Display *dpy, Window w);
+void action_toggle_sticky(Display *dpy, Window w);
+void action_toggle_above(Display *dpy, Window w);
+void action_toggle_below(Display *dpy, Window w);
+void action_desktop(Display *dpy, long desktop);
+void action_desktop_offset(Display *dpy, int offset);
+void action_keypress(Display *dpy, Action *action);
+int action_keypress_compile(Action *action, Arena *arena);
+void actions_mapping_notify(XMappingEvent *event);
 
 #endif
@@ -0,0 +1,179 @@
+/*
+ Copyright 2016 Lucas Augusto Deters
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2, or (at your option)
+ any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ one line to give the program's name and an idea of what it does.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "arena.h"
+
+/* every allocation is aligned for any type */
+#define ARENA_ALIGN 16
+#define ARENA_ROUND(size) (((size) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1))
+
+Arena * arena_new() {
+
+	Arena * self = malloc(sizeof(Arena));
+	memset(self, 0, sizeof(Arena));
+
+	return self;
+}
+
+void arena_free(Arena * self) {
+
+	if (!self) {
+		return;
+	}
+
+	ArenaChunk * chunk = self->chunks;
+
+	while (chunk) {
+		ArenaChunk * next = chunk->next;
+		free(chunk->data);
+		free(chunk);
+		chunk = next;
+	}
+
+	free(self->strings);
+	free(self);
+}
+
+static ArenaChunk * arena_add_chunk(Arena * self, size_t size) {
+
+	ArenaChunk * chunk = malloc(sizeof(ArenaChunk));
+
+	chunk->size = size;
+	chunk->used = 0;
+
+	/* malloc aligns for any type already */
+	chunk->data = malloc(size);
+
+	chunk->next = self->chunks;
+	self->chunks = chunk;
+
+	return chunk;
+}
+
+/*
+ * Returns 'size' bytes filled with zeros, that live until arena_free.
+ */
+void * arena_alloc(Arena * self, size_t size) {
+
+	assert(self);
+
+	size = ARENA_ROUND(size ? size : 1);
+
+	ArenaChunk * chunk = self->chunks;
+
+	if (!chunk || chunk->size - chunk->used < size) {
+		if (size > ARENA_CHUNK_SIZE / 4) {
+			/* big blocks get a chunk of their own, behind the current one */
+			ArenaChunk * current = self->chunks;
+			chunk = arena_add_chunk(self, size);
+			if (current) {
+				self->chunks = current;
+				chunk->next = current->next;
+				current->next = chunk;
+			}
+		} else {
+			chunk = arena_add_chunk(self, ARENA_CHUNK_SIZE);
+		}
+	}
+
+	void * data = chunk->data + chunk->used;
+	chunk->used += size;
+	self->used += size;
+
+	memset(data, 0, size);
+
+	return data;
+}
+
+void * arena_copy(Arena * self, const void * data, size_t size) {
+
+	void * copy = arena_alloc(self, size);
+
+	if (size) {
+		memcpy(copy, data, size);
+	}
+
+	return copy;
+}
+
+static unsigned int string_hash(const char * string) {
+
+	unsigned int h = 2166136261u;
+
+	for (const char * c = string; *c; ++c) {
+		h = (h ^ (unsigned char) *c) * 16777619u;
+	}
+
+	return h;
+}
+
+static void arena_grow_strings(Arena * self) {
+
+	int old_size = self->string_size;
+	char ** old_strings = self->strings;
+
+	self->string_size = old_size ? old_size * 2 : 256;
+	self->strings = calloc(self->string_size, sizeof(char *));
+
+	for (int i = 0; i < old_size; ++i) {
+		if (!old_strings[i]) {
+			continue;
+		}
+		unsigned int slot = string_hash(old_strings[i]) & (self->string_size - 1);
+		while (self->strings[slot]) {
+			slot = (slot + 1) & (self->string_size - 1);
+		}
+		self->strings[slot] = old_strings[i];
+	}
+
+	free(old_strings);
+}
+
+/*
+ * A copy of 'string' in the arena. Equal strings return the same copy, so
+ * they can't be changed.
+ */
+char * arena_intern(Arena * self, const char * string) {
+
+	assert(self);
+	assert(string);
+
+	if (self->string_count * 2 >= self->string_size) {
+		arena_grow_strings(self);
+	}
+
+	unsigned int slot = string_hash(string) & (self->string_size - 1);
+
+	while (self->strings[slot]) {
+		if (strcmp(self->strings[slot], string) == 0) {
+			return self->strings[slot];
+		}
+		slot = (slot + 1) & (self->string_size - 1);
+	}
+
+	self->strings[slot] = arena_copy(self, string, strlen(string) + 1);
+	self->string_count++;
+
+	return self->strings[slot];
+}
@@ -0,0 +1,54 @@
+/*
+ Copyright 2016 Lucas Augusto Deters
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2, or (at your option)
+ any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ one line to give the program's name and an idea of what it does.
+ */
+
+#ifndef MYGESTURES_ARENA_H_
+#define MYGESTURES_ARENA_H_
+
+#include <stddef.h>
+
+#define ARENA_CHUNK_SIZE 16384
+
+typedef struct arena_chunk_ {
+	struct arena_chunk_ * next;
+	size_t size;
+	size_t used;
+	char * data;
+} ArenaChunk;
+
+/*
+ * Memory that is only given back all at once, by arena_free. Equal strings
+ * given to arena_intern share a single copy.
+ */
+typedef struct arena_ {
+	ArenaChunk * chunks;
+
+	/* bytes given out, for the statistics */
+	size_t used;
+
+	/* open addressing table of the interned strings */
+	char ** strings;
+	int string_count;
+	int string_size;
+} Arena;
+
+Arena * arena_new();
+void arena_free(Arena * self);
+
+void * arena_alloc(Arena * self, size_t size);
+void * arena_copy(Arena * self, const void * data, size_t size);
+char * arena_intern(Arena * self, const char * string);
+
+#endif
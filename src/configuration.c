@@ -24,111 +24,135 @@
 #include <string.h>
 #include <regex.h>
 #include <assert.h>
+#include <sys/mman.h>
 
 #include "configuration.h"
+#include "matcher.h"
+#include "actions.h"
 
-void context_set_title(Context* context, char* window_title) {
+const char stroke_representations[] = { ' ', 'L', 'R', 'U', 'D', '1', '3', '7',
+		'9' };
 
-	assert(context);
-	assert(window_title);
+/*
+ * Make room for one more element at the end of a growing array, and return
+ * it filled with zeros.
+ */
+static void * array_append(void * list_ptr, int * count, int * size,
+		size_t element_size) {
 
-	context->title = window_title;
+	void ** list = list_ptr;
 
-	regex_t* title_compiled = NULL;
-	if (context->title) {
-		title_compiled = malloc(sizeof(regex_t));
-		if (regcomp(title_compiled, window_title, REG_EXTENDED | REG_NOSUB)) {
-			fprintf(stderr, "Error compiling regexp: %s\n", window_title);
-			free(title_compiled);
-			title_compiled = NULL;
-		}
+	if (*count == *size) {
+		*size = *size ? *size * 2 : 16;
+		*list = realloc(*list, element_size * *size);
 	}
-	context->title_compiled = title_compiled;
+
+	char * element = (char *) *list + element_size * (*count)++;
+	memset(element, 0, element_size);
+
+	return element;
 }
 
-void context_set_class(Context* context, char* window_class) {
+/* compile 'pattern' into the arena. NULL if it is invalid */
+static regex_t * configuration_compile(Configuration * self, char * pattern,
+		const char * error_message) {
 
-	assert(context);
-	assert(window_class);
+	regex_t * compiled = arena_alloc(self->arena, sizeof(regex_t));
 
-	context->class = window_class;
-	regex_t* class_compiled = NULL;
-	if (context->class) {
-		class_compiled = malloc(sizeof(regex_t));
-		if (regcomp(class_compiled, window_class, REG_EXTENDED | REG_NOSUB)) {
-			fprintf(stderr, "Error compiling regexp: %s\n", window_class);
-			class_compiled = NULL;
-		}
+	if (regcomp(compiled, pattern, REG_EXTENDED | REG_NOSUB) != 0) {
+		fprintf(stderr, error_message, pattern);
+		self->warning_count++;
+		return NULL;
 	}
-	context->class_compiled = class_compiled;
+
+	return compiled;
 }
 
-/* alloc a window struct */
+/* compile the window title and class expressions of a context */
+void context_compile(Configuration * self, Context * context) {
+
+	context->title_compiled = configuration_compile(self, context->title,
+			"Error compiling regexp: %s\n");
+	context->class_compiled = configuration_compile(self, context->class,
+			"Error compiling regexp: %s\n");
+}
+
+/*
+ * Returns the new context. The pointer is valid until the next context is
+ * created, gestures must be created right after their context.
+ */
 Context *configuration_create_context(Configuration * self, char * context_name,
 		char *window_title, char *window_class) {
 
 	assert(self);
+	assert(!self->frozen);
 	assert(context_name);
 	assert(window_title);
 	assert(window_class);
 
-	Context *context = malloc(sizeof(Context));
-	bzero(context, sizeof(Context));
+	Context *context = array_append(&self->context_list, &self->context_count,
+			&self->context_size, sizeof(Context));
 
-	context->name = context_name;
+	context->name = arena_intern(self->arena, context_name);
+	context->title = arena_intern(self->arena, window_title);
+	context->class = arena_intern(self->arena, window_class);
 	context->parent_user_configuration = self;
 
-	context_set_title(context, window_title);
-	context_set_class(context, window_class);
+	context_compile(self, context);
 
-	context->gesture_list = malloc(sizeof(Gesture) * 255);
+	context->gesture_first = self->gesture_count;
 	context->gesture_count = 0;
 
-	self->context_list[self->context_count++] = context;
-
 	return context;
 }
 
-void movement_set_expression(Movement* movement, char* movement_expression) {
-	movement->expression = movement_expression;
-	char* regex_str = malloc(sizeof(char) * (strlen(movement_expression) + 5));
-	strcpy(regex_str, "");
-	strcat(regex_str, "^(");
-	strcat(regex_str, movement_expression);
-	strcat(regex_str, ")$");
-	regex_t* movement_compiled = NULL;
-	movement_compiled = malloc(sizeof(regex_t));
-	if (regcomp(movement_compiled, regex_str, REG_EXTENDED | REG_NOSUB) != 0) {
-		fprintf(stderr, "Warning: Invalid movement sequence: %s\n", regex_str);
-		free(movement_compiled);
-		movement_compiled = NULL;
-	} else {
-		regcomp(movement_compiled, regex_str, REG_EXTENDED | REG_NOSUB);
-	}
+/* compile the expression of a movement, to match whole sequences */
+void movement_compile(Configuration * self, Movement* movement) {
+
+	char* regex_str = malloc(strlen(movement->expression) + 5);
+	sprintf(regex_str, "^(%s)$", movement->expression);
+
+	movement->expression_compiled = configuration_compile(self, regex_str,
+			"Warning: Invalid movement sequence: %s\n");
+	movement->valid = movement->expression_compiled != NULL;
+
 	free(regex_str);
-	movement->expression_compiled = movement_compiled;
 }
 
-/* alloc a movement struct */
+void movement_set_expression(Configuration * self, Movement* movement,
+		char* movement_expression) {
+
+	movement->expression = arena_intern(self->arena, movement_expression);
+
+	movement_compile(self, movement);
+}
+
+/*
+ * Returns the new movement. The pointer is valid until the next movement is
+ * created.
+ */
 Movement *configuration_create_movement(Configuration * self,
 		char *movement_name, char *movement_expression) {
 
 	assert(self);
+	assert(!self->frozen);
 	assert(movement_name);
 	assert(movement_expression);
 
-	Movement * movement = malloc(sizeof(Movement));
-	bzero(movement, sizeof(Movement));
-
-	movement->name = movement_name;
-	movement_set_expression(movement, movement_expression);
+	Movement * movement = array_append(&self->movement_list,
+			&self->movement_count, &self->movement_size, sizeof(Movement));
 
-	self->movement_list[self->movement_count] = movement;
-	self->movement_count++;
+	movement->id = self->movement_count - 1;
+	movement->name = arena_intern(self->arena, movement_name);
+	movement_set_expression(self, movement, movement_expression);
 
 	return movement;
 }
 
+/*
+ * Returns the new gesture. The pointer is valid until the next gesture is
+ * created, actions must be created right after their gesture.
+ */
 Gesture * configuration_create_gesture(Context * self, char * gesture_name,
 		char * gesture_movement) {
 
@@ -136,31 +160,41 @@ Gesture * configuration_create_gesture(Context * self, char * gesture_name,
 	assert(gesture_name);
 	assert(gesture_movement);
 
-	Gesture *ans = malloc(sizeof(Gesture));
-	bzero(ans, sizeof(Gesture));
+	Configuration * conf = self->parent_user_configuration;
+
+	assert(!conf->frozen);
+
+	/* the gestures of a context are kept together */
+	assert(self == &conf->context_list[conf->context_count - 1]);
+
+	Gesture *ans = array_append(&conf->gesture_list, &conf->gesture_count,
+			&conf->gesture_size, sizeof(Gesture));
 
-	Movement *m = NULL;
+	ans->name = arena_intern(conf->arena, gesture_name);
+	ans->context_id = self - conf->context_list;
+	ans->movement_id = -1;
 
-	ans->name = gesture_name;
-	ans->movement = configuration_find_movement_by_name(
-			self->parent_user_configuration, gesture_movement);
+	Movement * movement = configuration_find_movement_by_name(conf,
+			gesture_movement);
 
-	if (!ans->movement) {
-		printf(
-				"Movement '%s' referenced by gesture '%s' is unknown. The gesture will be inaccessible.\n",
-				gesture_movement, gesture_name);
+	/* reported by the parser, which knows where the gesture is */
+	if (movement) {
+		ans->movement_id = movement->id;
 	}
 
 	ans->context = self;
+	ans->action_first = conf->action_count;
 	ans->action_count = 0;
-	ans->action_list = malloc(sizeof(Action) * 20);
 
-	self->gesture_list[self->gesture_count++] = ans;
+	self->gesture_count++;
 
 	return ans;
 }
 
-/* alloc an action struct */
+/*
+ * Returns the new action. The pointer is valid until the next action is
+ * created.
+ */
 Action *configuration_create_action(Gesture * self, int action_type,
 		char * action_data) {
 
@@ -168,31 +202,94 @@ Action *configuration_create_action(Gesture * self, int action_type,
 	assert(action_type);
 	assert(action_data);
 
-	Action *ans = malloc(sizeof(Action));
-	bzero(ans, sizeof(Action));
+	Configuration * conf = self->context->parent_user_configuration;
+
+	assert(!conf->frozen);
+
+	/* the actions of a gesture are kept together */
+	assert(self == &conf->gesture_list[conf->gesture_count - 1]);
+
+	Action *ans = array_append(&conf->action_list, &conf->action_count,
+			&conf->action_size, sizeof(Action));
 
 	ans->type = action_type;
-	ans->original_str = action_data;
+	ans->original_str = arena_intern(conf->arena, action_data);
 
-	self->action_list[self->action_count++] = ans;
+	if (action_type == ACTION_KEYPRESS) {
+		action_keypress_compile(ans, conf->arena);
+	}
+
+	self->action_count++;
 
 	return ans;
 }
 
-Gesture * match_gesture(Configuration * self, char * captured_sequence,
-		ActiveWindowInfo * window) {
+static unsigned int window_info_hash(ActiveWindowInfo * window) {
+
+	unsigned int h = 2166136261u;
+
+	for (char * c = window->class; *c; ++c) {
+		h = (h ^ (unsigned char) *c) * 16777619u;
+	}
+
+	h = (h ^ 0xff) * 16777619u;
+
+	for (char * c = window->title; *c; ++c) {
+		h = (h ^ (unsigned char) *c) * 16777619u;
+	}
+
+	return h;
+}
+
+static void context_cache_entry_clear(ContextCacheEntry * entry) {
+
+	free(entry->class);
+	free(entry->title);
+	free(entry->context_list);
+
+	bzero(entry, sizeof(ContextCacheEntry));
+}
+
+void configuration_clear_context_cache(Configuration * self) {
 
 	assert(self);
-	assert(captured_sequence);
-	assert(window);
 
-	Gesture * matched_gesture = NULL;
+	for (int i = 0; i < CONTEXT_CACHE_SIZE; ++i) {
+		context_cache_entry_clear(&self->context_cache[i]);
+	}
+}
+
+/*
+ * Return the contexts whose window class and title expressions match the
+ * window. Results are cached, so the expressions are only evaluated the first
+ * time a window class and title pair shows up.
+ */
+static ContextCacheEntry * configuration_resolve_contexts(
+		Configuration * self, ActiveWindowInfo * window) {
+
+	unsigned int hash = window_info_hash(window);
+
+	ContextCacheEntry * entry = &self->context_cache[hash % CONTEXT_CACHE_SIZE];
+
+	if (entry->context_list && entry->hash == hash
+			&& strcmp(entry->class, window->class) == 0
+			&& strcmp(entry->title, window->title) == 0) {
+		return entry;
+	}
+
+	context_cache_entry_clear(entry);
+
+	entry->hash = hash;
+	entry->class = strdup(window->class);
+	entry->title = strdup(window->title);
+	entry->context_list = malloc(sizeof(Context *) * (self->context_count + 1));
+	entry->context_count = 0;
 
 	int c = 0;
 
 	for (c = 0; c < self->context_count; ++c) {
 
-		Context * context = self->context_list[c];
+		Context * context = &self->context_list[c];
 
 		assert(context->class);
 		assert(context->title);
@@ -207,20 +304,73 @@ Gesture * match_gesture(Configuration * self, char * captured_sequence,
 			continue;
 		}
 
-		assert(context->gesture_count);
+		entry->context_list[entry->context_count++] = context;
+	}
+
+	return entry;
+}
+
+static int movement_matches(Movement * movement, char * captured_sequence,
+		const unsigned int * matches) {
+
+	if (!movement) {
+		return 0;
+	}
+
+	if (matches) {
+		return MATCHER_TEST(matches, movement->id);
+	}
+
+	if (!movement->expression_compiled) {
+		return 0;
+	}
+
+	return regexec(movement->expression_compiled, captured_sequence, 0,
+			(regmatch_t *) NULL, 0) == 0;
+}
+
+/*
+ * 'matcher_state' is the state reached by feeding the sequence to the
+ * matcher while it was captured, or -1 to run the whole sequence now.
+ */
+Gesture * match_gesture(Configuration * self, char * captured_sequence,
+		int matcher_state, ActiveWindowInfo * window) {
+
+	assert(self);
+	assert(captured_sequence);
+	assert(window);
+
+	Gesture * matched_gesture = NULL;
+
+	/* every movement matching the sequence, found in a single pass */
+	const unsigned int * matches = NULL;
+
+	if (self->matcher) {
+		if (matcher_state < 0) {
+			matcher_state = matcher_run(self->matcher, MATCHER_START_STATE,
+					captured_sequence);
+		}
+		matches = matcher_match_state(self->matcher, matcher_state,
+				captured_sequence);
+	}
+
+	ContextCacheEntry * contexts = configuration_resolve_contexts(self, window);
+
+	int c = 0;
+
+	for (c = 0; c < contexts->context_count; ++c) {
+
+		Context * context = contexts->context_list[c];
 
 		int g = 0;
 
 		for (g = 0; g < context->gesture_count; ++g) {
 
-			Gesture * gest = context->gesture_list[g];
+			Gesture * gest = &context->gesture_list[g];
 
 			assert(gest);
-			assert(gest->movement);
-			assert(gest->movement->expression_compiled);
 
-			if (regexec(gest->movement->expression_compiled, captured_sequence,
-					0, (regmatch_t *) NULL, 0) == 0) {
+			if (movement_matches(gest->movement, captured_sequence, matches)) {
 
 				matched_gesture = gest;
 				break;
@@ -246,7 +396,13 @@ Gesture * configuration_process_gesture(Configuration * self, Capture * grab) {
 	for (i = 0; i < grab->expression_count; ++i) {
 
 		char * sequence = grab->expression_list[i];
-		gest = match_gesture(self, sequence, grab->active_window_info);
+		int state = -1;
+
+		if (grab->matcher_state_list) {
+			state = grab->matcher_state_list[i];
+		}
+
+		gest = match_gesture(self, sequence, state, grab->active_window_info);
 
 		if (gest) {
 			return gest;
@@ -264,8 +420,6 @@ Movement * configuration_find_movement_by_name(Configuration * self,
 	assert(self);
 	assert(movement_name);
 
-	Context * ctx;
-
 	if (!movement_name) {
 		return NULL;
 	}
@@ -273,7 +427,7 @@ Movement * configuration_find_movement_by_name(Configuration * self,
 	int i = 0;
 
 	for (i = 0; i < self->movement_count; ++i) {
-		Movement * m = self->movement_list[i];
+		Movement * m = &self->movement_list[i];
 
 		if ((m->name) && (movement_name)
 				&& (strcasecmp(movement_name, m->name) == 0)) {
@@ -292,24 +446,168 @@ int configuration_get_gestures_count(Configuration * self) {
 	int count = 0;
 
 	for (int c = 0; c < self->context_count; ++c) {
-		count += self->context_list[c]->gesture_count;
+		count += self->context_list[c].gesture_count;
 	}
 
 	return count;
 
 }
 
+/* copy a growing array into the arena, and free it */
+static void * configuration_move_to_arena(Configuration * self, void * list,
+		int count, size_t element_size) {
+
+	void * moved = arena_copy(self->arena, list, element_size * count);
+	free(list);
+
+	return moved;
+}
+
+/*
+ * Move everything into the arena, with the exact sizes, link the structs
+ * and combine the expressions of all movements into a single automaton.
+ * Nothing can be created after that.
+ */
+void configuration_freeze(Configuration * self) {
+
+	assert(self);
+	assert(!self->frozen);
+
+	self->movement_list = configuration_move_to_arena(self,
+			self->movement_list, self->movement_count, sizeof(Movement));
+	self->context_list = configuration_move_to_arena(self, self->context_list,
+			self->context_count, sizeof(Context));
+	self->gesture_list = configuration_move_to_arena(self, self->gesture_list,
+			self->gesture_count, sizeof(Gesture));
+	self->action_list = configuration_move_to_arena(self, self->action_list,
+			self->action_count, sizeof(Action));
+
+	self->movement_size = self->movement_count;
+	self->context_size = self->context_count;
+	self->gesture_size = self->gesture_count;
+	self->action_size = self->action_count;
+
+	configuration_link(self);
+
+	configuration_clear_context_cache(self);
+
+	self->matcher = matcher_new(self->movement_list, self->movement_count);
+
+	if (!self->matcher) {
+		fprintf(stderr,
+				"Warning: Movements are too complex to be combined. Matching them one by one.\n");
+		return;
+	}
+
+	if (self->matcher->fallback_count) {
+		printf("%i movements will be matched with regexec.\n",
+				self->matcher->fallback_count);
+	}
+}
+
+/*
+ * Turn the indexes kept while parsing into pointers, once the arrays don't
+ * move anymore. The configuration is frozen after that.
+ */
+void configuration_link(Configuration * self) {
+
+	for (int c = 0; c < self->context_count; ++c) {
+		Context * context = &self->context_list[c];
+		context->gesture_list = &self->gesture_list[context->gesture_first];
+	}
+
+	for (int g = 0; g < self->gesture_count; ++g) {
+		Gesture * gest = &self->gesture_list[g];
+		gest->context = &self->context_list[gest->context_id];
+		gest->action_list = &self->action_list[gest->action_first];
+		gest->movement = NULL;
+		if (gest->movement_id >= 0) {
+			gest->movement = &self->movement_list[gest->movement_id];
+		}
+	}
+
+	self->frozen = 1;
+}
+
 Configuration * configuration_new() {
 
 	Configuration * self = malloc(sizeof(Configuration));
 	bzero(self, sizeof(Configuration));
 
-	self->movement_count = 0;
-	self->movement_list = malloc(sizeof(Movement *) * 254);
+	self->arena = arena_new();
+	self->ref_count = 1;
 
-	self->context_count = 0;
-	self->context_list = malloc(sizeof(Context *) * 254);
+	self->context_cache = malloc(sizeof(ContextCacheEntry) * CONTEXT_CACHE_SIZE);
+	bzero(self->context_cache, sizeof(ContextCacheEntry) * CONTEXT_CACHE_SIZE);
 
 	return self;
 
 }
+
+/*
+ * A gesture keeps the configuration it started with, even if it is
+ * reloaded before the gesture ends.
+ */
+Configuration * configuration_ref(Configuration * self) {
+
+	assert(self);
+
+	self->ref_count++;
+
+	return self;
+}
+
+void configuration_unref(Configuration * self) {
+
+	if (!self) {
+		return;
+	}
+
+	assert(self->ref_count > 0);
+
+	if (--self->ref_count == 0) {
+		configuration_free(self);
+	}
+}
+
+void configuration_free(Configuration * self) {
+
+	if (!self) {
+		return;
+	}
+
+	configuration_clear_context_cache(self);
+	free(self->context_cache);
+
+	matcher_free(self->matcher);
+
+	/* regcomp allocates outside the arena */
+	for (int i = 0; i < self->movement_count; ++i) {
+		if (self->movement_list[i].expression_compiled) {
+			regfree(self->movement_list[i].expression_compiled);
+		}
+	}
+
+	for (int i = 0; i < self->context_count; ++i) {
+		if (self->context_list[i].title_compiled) {
+			regfree(self->context_list[i].title_compiled);
+		}
+		if (self->context_list[i].class_compiled) {
+			regfree(self->context_list[i].class_compiled);
+		}
+	}
+
+	if (!self->frozen) {
+		free(self->movement_list);
+		free(self->context_list);
+		free(self->gesture_list);
+		free(self->action_list);
+	}
+
+	if (self->mapping) {
+		munmap(self->mapping, self->mapping_size);
+	}
+
+	arena_free(self->arena);
+	free(self);
+}
@@ -19,19 +19,38 @@
 #define MYGESTURES_CONFIGURATION_H_
 
 #include <regex.h>
+#include <X11/X.h>
+
+#include "arena.h"
 
 #define GEST_SEQUENCE_MAX 64
 #define GEST_ACTION_NAME_MAX 32
 #define GEST_EXTRA_DATA_MAX 4096
 
+/* number of (window class, window title) pairs remembered by match_gesture */
+#define CONTEXT_CACHE_SIZE 64
+
 /* the movements */
 enum STROKES {
-	NONE, LEFT, RIGHT, UP, DOWN, ONE, THREE, SEVEN, NINE
+	NONE, LEFT, RIGHT, UP, DOWN, ONE, THREE, SEVEN, NINE, STROKES_COUNT
 };
 
+/* the char used for each stroke on a captured sequence */
+extern const char stroke_representations[];
+
 typedef struct movement_ {
+	int id;
 	char *name;
-	void *expression;
+	char *expression;
+
+	/* 0 if the expression doesn't compile. It never matches */
+	int valid;
+
+	/* line in the file, 0 if unknown */
+	int line;
+
+	/* NULL if not valid. Configurations loaded from the cache only compile
+	 * the expressions the matcher can't handle */
 	regex_t * expression_compiled;
 } Movement;
 
@@ -42,36 +61,103 @@ typedef struct context_ {
 
 	struct user_configuration_ * parent_user_configuration;
 
-	struct gesture_ ** gesture_list;
+	/* a slice of the gesture_list of the configuration */
+	struct gesture_ * gesture_list;
+	int gesture_first;
 	int gesture_count;
 
 	int abort;
+	int line;
 	regex_t * title_compiled;
 	regex_t * class_compiled;
 
 } Context;
 
+/* the contexts that apply to a given window class and title, in file order */
+typedef struct context_cache_entry_ {
+	unsigned int hash;
+	char *class;
+	char *title;
+
+	struct context_ ** context_list;
+	int context_count;
+} ContextCacheEntry;
+
+/*
+ * Everything is created in growing arrays while the file is parsed, and
+ * moved into the arena by configuration_freeze. After that the configuration
+ * doesn't change, and configuration_free releases all of it at once.
+ */
 typedef struct user_configuration_ {
 
-	Movement** movement_list;
+	Arena * arena;
+	int frozen;
+
+	/* freed by configuration_unref when the last reference goes away */
+	int ref_count;
+
+	/* the file it was loaded from, NULL if none */
+	char * filename;
+
+	/* problems found while loading it, see configuration_check */
+	int warning_count;
+
+	/* the cache it was loaded from, see configuration_cache.c. strings and
+	 * matcher tables point into it */
+	void * mapping;
+	size_t mapping_size;
+
+	Movement * movement_list;
 	int movement_count;
+	int movement_size;
 
-	Context ** context_list;
+	Context * context_list;
 	int context_count;
+	int context_size;
+
+	/* the gestures of all contexts, grouped by context */
+	struct gesture_ * gesture_list;
+	int gesture_count;
+	int gesture_size;
+
+	/* the actions of all gestures, grouped by gesture */
+	struct action_ * action_list;
+	int action_count;
+	int action_size;
+
+	struct matcher_ * matcher;
+
+	ContextCacheEntry * context_cache;
 } Configuration;
 
 typedef struct action_ {
 	int type;
-	//struct key_press *data;
 	char *original_str;
+
+	/* ACTION_KEYPRESS: the keys in original_str, parsed at load time */
+	KeySym *keysym_list;
+	KeyCode *keycode_list;
+	int key_count;
+	int keymap_serial;
+	/* milliseconds between faked key events, for apps that drop fast input */
+	int key_delay;
 } Action;
 
 typedef struct gesture_ {
 	char * name;
 	Context *context;
 	Movement *movement;
-	Action ** action_list;
+
+	/* a slice of the action_list of the configuration */
+	Action * action_list;
+	int action_first;
 	int action_count;
+
+	/* indexes used until the configuration is frozen, -1 if unknown */
+	int context_id;
+	int movement_id;
+
+	int line;
 } Gesture;
 
 typedef struct active_window_info_ {
@@ -82,10 +168,15 @@ typedef struct active_window_info_ {
 typedef struct capture_ {
 	int expression_count;
 	char ** expression_list;
+	/* matcher state reached by each expression, or -1 if unknown */
+	int * matcher_state_list;
 	ActiveWindowInfo * active_window_info;
 } Capture;
 
 Configuration * configuration_new();
+void configuration_free(Configuration * self);
+Configuration * configuration_ref(Configuration * self);
+void configuration_unref(Configuration * self);
 
 Context * configuration_create_context(	Configuration * self,
 										char * context_name,
@@ -98,6 +189,11 @@ Movement * configuration_create_movement(	Configuration * self,
 Action * configuration_create_action(Gesture * self, int action_type, char * original_str);
 Movement * configuration_find_movement_by_name(Configuration * self, char * movement_name);
 int configuration_get_gestures_count(Configuration * self);
+void configuration_freeze(Configuration * self);
+void configuration_link(Configuration * self);
+void context_compile(Configuration * self, Context * context);
+void movement_compile(Configuration * self, Movement * movement);
+void configuration_clear_context_cache(Configuration * self);
 Gesture * configuration_process_gesture(Configuration * self, Capture * capture);
 
 #endif
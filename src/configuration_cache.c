@@ -0,0 +1,676 @@
+/*
+ Copyright 2016 Lucas Augusto Deters
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2, or (at your option)
+ any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ one line to give the program's name and an idea of what it does.
+ */
+
+/*
+ * A parsed configuration saved next to its file, as "<file>.cache".
+ *
+ * The cache is only used if the size, modification time and contents of the
+ * file didn't change since it was written. It is mapped read-only: the
+ * strings and matcher tables are used where they are, only the structs are
+ * rebuilt in the arena of the configuration.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <assert.h>
+
+#include "configuration_cache.h"
+#include "matcher.h"
+#include "actions.h"
+
+#define CACHE_MAGIC "MYGCACHE"
+#define CACHE_VERSION 2
+
+/* sections start aligned, so the tables can be used from the mapping */
+#define CACHE_ALIGN 16
+
+typedef struct cache_header_ {
+	char magic[8];
+	uint32_t version;
+	/* changes if the layout of the structs below changes */
+	uint32_t header_size;
+
+	CacheKey key;
+
+	int32_t movement_count;
+	int32_t context_count;
+	int32_t gesture_count;
+	int32_t action_count;
+	int32_t keysym_count;
+
+	/* the action numbers are only valid for the same ACTION_COUNT */
+	int32_t action_kinds;
+
+	/* 0 without a matcher */
+	int32_t state_count;
+	int32_t accept_words;
+	int32_t fallback_count;
+
+	uint64_t strings_size;
+
+	/* offsets of the sections, from the start of the file */
+	uint64_t movements;
+	uint64_t contexts;
+	uint64_t gestures;
+	uint64_t actions;
+	uint64_t keysyms;
+	uint64_t transitions;
+	uint64_t accept;
+	uint64_t viable;
+	uint64_t fallbacks;
+	uint64_t strings;
+} CacheHeader;
+
+/* strings are offsets into the strings section */
+
+typedef struct cache_movement_ {
+	uint32_t name;
+	uint32_t expression;
+	int32_t valid;
+} CacheMovement;
+
+typedef struct cache_context_ {
+	uint32_t name;
+	uint32_t title;
+	uint32_t class;
+	int32_t gesture_first;
+	int32_t gesture_count;
+} CacheContext;
+
+typedef struct cache_gesture_ {
+	uint32_t name;
+	int32_t context_id;
+	int32_t movement_id;
+	int32_t action_first;
+	int32_t action_count;
+} CacheGesture;
+
+typedef struct cache_action_ {
+	int32_t type;
+	uint32_t original_str;
+	int32_t key_delay;
+	int32_t keysym_first;
+	int32_t key_count;
+} CacheAction;
+
+typedef struct cache_buffer_ {
+	char * data;
+	size_t size;
+	size_t capacity;
+} CacheBuffer;
+
+static char * cache_filename(const char * filename) {
+
+	char * cache = malloc(strlen(filename) + strlen(".cache") + 1);
+	sprintf(cache, "%s.cache", filename);
+
+	return cache;
+}
+
+/*
+ * Read the file to identify its contents. Returns 0 on success.
+ */
+int configuration_cache_key(const char * filename, CacheKey * key) {
+
+	memset(key, 0, sizeof(CacheKey));
+
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		return 1;
+	}
+
+	struct stat st;
+
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return 1;
+	}
+
+	key->mtime_sec = st.st_mtim.tv_sec;
+	key->mtime_nsec = st.st_mtim.tv_nsec;
+	key->size = st.st_size;
+
+	/* FNV-1a */
+	uint64_t hash = 14695981039346656037ull;
+	unsigned char buffer[4096];
+	ssize_t bytes;
+
+	while ((bytes = read(fd, buffer, sizeof(buffer))) > 0) {
+		for (ssize_t i = 0; i < bytes; ++i) {
+			hash = (hash ^ buffer[i]) * 1099511628211ull;
+		}
+	}
+
+	close(fd);
+
+	if (bytes < 0) {
+		return 1;
+	}
+
+	key->hash = hash;
+
+	return 0;
+}
+
+/* returns the offset of the copy */
+static uint64_t buffer_append(CacheBuffer * buffer, const void * data,
+		size_t size, size_t align) {
+
+	size_t offset = (buffer->size + align - 1) & ~(align - 1);
+
+	if (offset + size > buffer->capacity) {
+		while (offset + size > buffer->capacity) {
+			buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+		}
+		buffer->data = realloc(buffer->data, buffer->capacity);
+	}
+
+	memset(buffer->data + buffer->size, 0, offset - buffer->size);
+
+	if (size) {
+		memcpy(buffer->data + offset, data, size);
+	}
+
+	buffer->size = offset + size;
+
+	return offset;
+}
+
+static uint32_t buffer_string(CacheBuffer * strings, const char * string) {
+	return buffer_append(strings, string, strlen(string) + 1, 1);
+}
+
+/*
+ * Write the cache of a frozen configuration, read from a file identified by
+ * 'key'. Returns 0 on success.
+ */
+int configuration_cache_save(Configuration * self, const char * filename,
+		CacheKey * key) {
+
+	if (!self->frozen) {
+		return 1;
+	}
+
+	CacheHeader header;
+	memset(&header, 0, sizeof(CacheHeader));
+
+	memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+	header.version = CACHE_VERSION;
+	header.header_size = sizeof(CacheHeader);
+	header.key = *key;
+
+	header.movement_count = self->movement_count;
+	header.context_count = self->context_count;
+	header.gesture_count = self->gesture_count;
+	header.action_count = self->action_count;
+	header.action_kinds = ACTION_COUNT;
+
+	CacheBuffer file;
+	CacheBuffer strings;
+	memset(&file, 0, sizeof(CacheBuffer));
+	memset(&strings, 0, sizeof(CacheBuffer));
+
+	/* written again at the end, with the offsets */
+	buffer_append(&file, &header, sizeof(CacheHeader), CACHE_ALIGN);
+
+	CacheMovement * movements = calloc(self->movement_count + 1,
+			sizeof(CacheMovement));
+
+	for (int i = 0; i < self->movement_count; ++i) {
+		Movement * movement = &self->movement_list[i];
+		movements[i].name = buffer_string(&strings, movement->name);
+		movements[i].expression = buffer_string(&strings, movement->expression);
+		movements[i].valid = movement->valid;
+	}
+
+	header.movements = buffer_append(&file, movements,
+			sizeof(CacheMovement) * self->movement_count, CACHE_ALIGN);
+	free(movements);
+
+	CacheContext * contexts = calloc(self->context_count + 1,
+			sizeof(CacheContext));
+
+	for (int i = 0; i < self->context_count; ++i) {
+		Context * context = &self->context_list[i];
+		contexts[i].name = buffer_string(&strings, context->name);
+		contexts[i].title = buffer_string(&strings, context->title);
+		contexts[i].class = buffer_string(&strings, context->class);
+		contexts[i].gesture_first = context->gesture_first;
+		contexts[i].gesture_count = context->gesture_count;
+	}
+
+	header.contexts = buffer_append(&file, contexts,
+			sizeof(CacheContext) * self->context_count, CACHE_ALIGN);
+	free(contexts);
+
+	CacheGesture * gestures = calloc(self->gesture_count + 1,
+			sizeof(CacheGesture));
+
+	for (int i = 0; i < self->gesture_count; ++i) {
+		Gesture * gesture = &self->gesture_list[i];
+		gestures[i].name = buffer_string(&strings, gesture->name);
+		gestures[i].context_id = gesture->context_id;
+		gestures[i].movement_id = gesture->movement_id;
+		gestures[i].action_first = gesture->action_first;
+		gestures[i].action_count = gesture->action_count;
+	}
+
+	header.gestures = buffer_append(&file, gestures,
+			sizeof(CacheGesture) * self->gesture_count, CACHE_ALIGN);
+	free(gestures);
+
+	CacheAction * actions = calloc(self->action_count + 1, sizeof(CacheAction));
+	CacheBuffer keysyms;
+	memset(&keysyms, 0, sizeof(CacheBuffer));
+
+	for (int i = 0; i < self->action_count; ++i) {
+		Action * action = &self->action_list[i];
+		actions[i].type = action->type;
+		actions[i].original_str = buffer_string(&strings, action->original_str);
+		actions[i].key_delay = action->key_delay;
+		actions[i].keysym_first = keysyms.size / sizeof(uint32_t);
+		actions[i].key_count = action->key_count;
+
+		for (int k = 0; k < action->key_count; ++k) {
+			uint32_t keysym = action->keysym_list[k];
+			buffer_append(&keysyms, &keysym, sizeof(uint32_t), sizeof(uint32_t));
+		}
+	}
+
+	header.keysym_count = keysyms.size / sizeof(uint32_t);
+
+	header.actions = buffer_append(&file, actions,
+			sizeof(CacheAction) * self->action_count, CACHE_ALIGN);
+	header.keysyms = buffer_append(&file, keysyms.data, keysyms.size,
+			CACHE_ALIGN);
+	free(actions);
+	free(keysyms.data);
+
+	Matcher * matcher = self->matcher;
+
+	if (matcher) {
+
+		size_t table_size = (size_t) matcher->state_count * matcher->accept_words
+				* sizeof(unsigned int);
+
+		header.state_count = matcher->state_count;
+		header.accept_words = matcher->accept_words;
+		header.fallback_count = matcher->fallback_count;
+
+		header.transitions = buffer_append(&file, matcher->transitions,
+				(size_t) matcher->state_count * STROKES_COUNT * sizeof(int),
+				CACHE_ALIGN);
+		header.accept = buffer_append(&file, matcher->accept, table_size,
+				CACHE_ALIGN);
+		header.viable = buffer_append(&file, matcher->viable, table_size,
+				CACHE_ALIGN);
+
+		int32_t * fallbacks = calloc(matcher->fallback_count + 1,
+				sizeof(int32_t));
+
+		for (int i = 0; i < matcher->fallback_count; ++i) {
+			fallbacks[i] = matcher->fallback_list[i]->id;
+		}
+
+		header.fallbacks = buffer_append(&file, fallbacks,
+				sizeof(int32_t) * matcher->fallback_count, CACHE_ALIGN);
+		free(fallbacks);
+	}
+
+	header.strings_size = strings.size;
+	header.strings = buffer_append(&file, strings.data, strings.size,
+			CACHE_ALIGN);
+	free(strings.data);
+
+	memcpy(file.data, &header, sizeof(CacheHeader));
+
+	/* readers never see a half written cache */
+	char * cache = cache_filename(filename);
+	char * temporary = malloc(strlen(cache) + strlen(".tmp") + 1);
+	sprintf(temporary, "%s.tmp", cache);
+
+	int err = 1;
+	int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	if (fd >= 0) {
+
+		size_t written = 0;
+
+		while (written < file.size) {
+			ssize_t bytes = write(fd, file.data + written, file.size - written);
+			if (bytes <= 0) {
+				break;
+			}
+			written += bytes;
+		}
+
+		err = close(fd) < 0 || written < file.size;
+
+		if (!err) {
+			err = rename(temporary, cache) < 0;
+		}
+
+		if (err) {
+			unlink(temporary);
+		}
+	}
+
+	free(file.data);
+	free(temporary);
+	free(cache);
+
+	return err;
+}
+
+/* the 'count' elements at 'offset', or NULL if they are not in the file */
+static const void * cache_section(const char * map, size_t map_size,
+		uint64_t offset, int64_t count, size_t element_size) {
+
+	if (count < 0 || offset % CACHE_ALIGN || offset > map_size) {
+		return NULL;
+	}
+
+	if ((uint64_t) count > (map_size - offset) / element_size) {
+		return NULL;
+	}
+
+	return map + offset;
+}
+
+static int cache_string_valid(const CacheHeader * header, uint32_t string) {
+	return string < header->strings_size;
+}
+
+static int cache_range_valid(int32_t first, int32_t count, int32_t total) {
+	return first >= 0 && count >= 0 && first <= total && count <= total - first;
+}
+
+/*
+ * Check everything the structs refer to, so a damaged cache is ignored
+ * instead of crashing later. Returns 0 if it can be used.
+ */
+static int cache_validate(const char * map, size_t map_size,
+		const CacheHeader * header) {
+
+	const CacheMovement * movements = cache_section(map, map_size,
+			header->movements, header->movement_count, sizeof(CacheMovement));
+	const CacheContext * contexts = cache_section(map, map_size,
+			header->contexts, header->context_count, sizeof(CacheContext));
+	const CacheGesture * gestures = cache_section(map, map_size,
+			header->gestures, header->gesture_count, sizeof(CacheGesture));
+	const CacheAction * actions = cache_section(map, map_size, header->actions,
+			header->action_count, sizeof(CacheAction));
+	const char * strings = cache_section(map, map_size, header->strings,
+			header->strings_size, 1);
+
+	if (!movements || !contexts || !gestures || !actions || !strings
+			|| !cache_section(map, map_size, header->keysyms,
+					header->keysym_count, sizeof(uint32_t))) {
+		return 1;
+	}
+
+	/* every string ends inside the section */
+	if (header->strings_size == 0 || strings[header->strings_size - 1]) {
+		return 1;
+	}
+
+	for (int i = 0; i < header->movement_count; ++i) {
+		if (!cache_string_valid(header, movements[i].name)
+				|| !cache_string_valid(header, movements[i].expression)) {
+			return 1;
+		}
+	}
+
+	for (int i = 0; i < header->context_count; ++i) {
+		if (!cache_string_valid(header, contexts[i].name)
+				|| !cache_string_valid(header, contexts[i].title)
+				|| !cache_string_valid(header, contexts[i].class)
+				|| !cache_range_valid(contexts[i].gesture_first,
+						contexts[i].gesture_count, header->gesture_count)) {
+			return 1;
+		}
+	}
+
+	for (int i = 0; i < header->gesture_count; ++i) {
+		if (!cache_string_valid(header, gestures[i].name)
+				|| gestures[i].context_id < 0
+				|| gestures[i].context_id >= header->context_count
+				|| gestures[i].movement_id < -1
+				|| gestures[i].movement_id >= header->movement_count
+				|| !cache_range_valid(gestures[i].action_first,
+						gestures[i].action_count, header->action_count)) {
+			return 1;
+		}
+	}
+
+	for (int i = 0; i < header->action_count; ++i) {
+		if (actions[i].type < 0 || actions[i].type >= ACTION_COUNT
+				|| !cache_string_valid(header, actions[i].original_str)
+				|| !cache_range_valid(actions[i].keysym_first,
+						actions[i].key_count, header->keysym_count)) {
+			return 1;
+		}
+	}
+
+	if (header->state_count == 0) {
+		return 0;
+	}
+
+	if (header->state_count <= MATCHER_START_STATE
+			|| header->accept_words != header->movement_count / 32 + 1) {
+		return 1;
+	}
+
+	int64_t table_count = (int64_t) header->state_count * header->accept_words;
+
+	const int * transitions = cache_section(map, map_size,
+			header->transitions, (int64_t) header->state_count * STROKES_COUNT,
+			sizeof(int));
+	const int32_t * fallbacks = cache_section(map, map_size, header->fallbacks,
+			header->fallback_count, sizeof(int32_t));
+
+	if (!transitions || !fallbacks
+			|| !cache_section(map, map_size, header->accept, table_count,
+					sizeof(unsigned int))
+			|| !cache_section(map, map_size, header->viable, table_count,
+					sizeof(unsigned int))) {
+		return 1;
+	}
+
+	for (int64_t i = 0; i < (int64_t) header->state_count * STROKES_COUNT; ++i) {
+		if (transitions[i] < 0 || transitions[i] >= header->state_count) {
+			return 1;
+		}
+	}
+
+	/* the matcher has room for each movement once */
+	if (header->fallback_count > header->movement_count) {
+		return 1;
+	}
+
+	char * seen = calloc(header->movement_count + 1, 1);
+	int err = 0;
+
+	for (int i = 0; i < header->fallback_count && !err; ++i) {
+		if (fallbacks[i] < 0 || fallbacks[i] >= header->movement_count
+				|| seen[fallbacks[i]]) {
+			err = 1;
+		} else {
+			seen[fallbacks[i]] = 1;
+		}
+	}
+
+	free(seen);
+
+	return err;
+}
+
+/*
+ * Fill an empty configuration from the cache of 'filename', if it was
+ * written for the contents identified by 'key'. Returns 0 on success. On
+ * failure the configuration is left untouched.
+ */
+int configuration_cache_load(Configuration * self, const char * filename,
+		CacheKey * key) {
+
+	assert(self);
+	assert(!self->frozen);
+	assert(!self->movement_count && !self->context_count);
+
+	char * cache = cache_filename(filename);
+	int fd = open(cache, O_RDONLY | O_CLOEXEC);
+	free(cache);
+
+	if (fd < 0) {
+		return 1;
+	}
+
+	struct stat st;
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(CacheHeader)) {
+		close(fd);
+		return 1;
+	}
+
+	size_t map_size = st.st_size;
+	char * map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		return 1;
+	}
+
+	const CacheHeader * header = (const CacheHeader *) map;
+
+	if (memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) != 0
+			|| header->version != CACHE_VERSION
+			|| header->header_size != sizeof(CacheHeader)
+			|| header->action_kinds != ACTION_COUNT
+			|| memcmp(&header->key, key, sizeof(CacheKey)) != 0
+			|| cache_validate(map, map_size, header) != 0) {
+		munmap(map, map_size);
+		return 1;
+	}
+
+	const CacheMovement * movements = (const void *) (map + header->movements);
+	const CacheContext * contexts = (const void *) (map + header->contexts);
+	const CacheGesture * gestures = (const void *) (map + header->gestures);
+	const CacheAction * actions = (const void *) (map + header->actions);
+	const uint32_t * keysyms = (const void *) (map + header->keysyms);
+	char * strings = map + header->strings;
+
+	Arena * arena = self->arena;
+
+	self->movement_count = self->movement_size = header->movement_count;
+	self->movement_list = arena_alloc(arena,
+			sizeof(Movement) * header->movement_count);
+
+	for (int i = 0; i < header->movement_count; ++i) {
+		Movement * movement = &self->movement_list[i];
+		movement->id = i;
+		movement->name = strings + movements[i].name;
+		movement->expression = strings + movements[i].expression;
+		movement->valid = movements[i].valid;
+	}
+
+	self->context_count = self->context_size = header->context_count;
+	self->context_list = arena_alloc(arena,
+			sizeof(Context) * header->context_count);
+
+	for (int i = 0; i < header->context_count; ++i) {
+		Context * context = &self->context_list[i];
+		context->name = strings + contexts[i].name;
+		context->title = strings + contexts[i].title;
+		context->class = strings + contexts[i].class;
+		context->parent_user_configuration = self;
+		context->gesture_first = contexts[i].gesture_first;
+		context->gesture_count = contexts[i].gesture_count;
+		context_compile(self, context);
+	}
+
+	self->gesture_count = self->gesture_size = header->gesture_count;
+	self->gesture_list = arena_alloc(arena,
+			sizeof(Gesture) * header->gesture_count);
+
+	for (int i = 0; i < header->gesture_count; ++i) {
+		Gesture * gesture = &self->gesture_list[i];
+		gesture->name = strings + gestures[i].name;
+		gesture->context_id = gestures[i].context_id;
+		gesture->movement_id = gestures[i].movement_id;
+		gesture->action_first = gestures[i].action_first;
+		gesture->action_count = gestures[i].action_count;
+	}
+
+	self->action_count = self->action_size = header->action_count;
+	self->action_list = arena_alloc(arena,
+			sizeof(Action) * header->action_count);
+
+	for (int i = 0; i < header->action_count; ++i) {
+		Action * action = &self->action_list[i];
+		action->type = actions[i].type;
+		action->original_str = strings + actions[i].original_str;
+		action->key_delay = actions[i].key_delay;
+		action->key_count = actions[i].key_count;
+		action->keysym_list = arena_alloc(arena,
+				sizeof(KeySym) * (action->key_count + 1));
+		action->keycode_list = arena_alloc(arena,
+				sizeof(KeyCode) * (action->key_count + 1));
+
+		for (int k = 0; k < action->key_count; ++k) {
+			action->keysym_list[k] = keysyms[actions[i].keysym_first + k];
+		}
+	}
+
+	configuration_link(self);
+
+	self->mapping = map;
+	self->mapping_size = map_size;
+
+	if (header->state_count) {
+
+		self->matcher = matcher_new_from_tables(self->movement_list,
+				self->movement_count, header->state_count,
+				(int *) (map + header->transitions),
+				(unsigned int *) (map + header->accept),
+				(unsigned int *) (map + header->viable),
+				(const int *) (map + header->fallbacks), header->fallback_count);
+
+		/* only these are matched with regexec */
+		for (int i = 0; i < self->matcher->fallback_count; ++i) {
+			movement_compile(self, self->matcher->fallback_list[i]);
+		}
+
+	} else {
+
+		for (int i = 0; i < self->movement_count; ++i) {
+			if (self->movement_list[i].valid) {
+				movement_compile(self, &self->movement_list[i]);
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,38 @@
+/*
+ Copyright 2016 Lucas Augusto Deters
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2, or (at your option)
+ any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ one line to give the program's name and an idea of what it does.
+ */
+
+#ifndef MYGESTURES_CONFIGURATIONCACHE_H_
+#define MYGESTURES_CONFIGURATIONCACHE_H_
+
+#include <stdint.h>
+
+#include "configuration.h"
+
+/* identifies the contents of a configuration file */
+typedef struct configuration_cache_key_ {
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	int64_t size;
+	uint64_t hash;
+} CacheKey;
+
+int configuration_cache_key(const char * filename, CacheKey * key);
+int configuration_cache_load(Configuration * self, const char * filename,
+		CacheKey * key);
+int configuration_cache_save(Configuration * self, const char * filename,
+		CacheKey * key);
+
+#endif
@@ -0,0 +1,447 @@
+/*
+ Copyright 2016 Lucas Augusto Deters
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2, or (at your option)
+ any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ one line to give the program's name and an idea of what it does.
+ */
+
+/*
+ * The --check mode. The languages of the movements are compared on the
+ * automaton of the matcher: a movement accepts a sequence if the state
+ * reached by the sequence has it in its accept set. So movement B includes
+ * movement A if every state accepting A also accepts B, and the shortest
+ * sequence reaching a state is an example of what it accepts.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <regex.h>
+
+#include "configuration_check.h"
+#include "matcher.h"
+
+/* times each gesture is matched to measure its cost */
+#define CHECK_MATCH_RUNS 1000
+
+typedef struct checker_ {
+	Configuration * conf;
+	Matcher * matcher;
+
+	/* every state, in breadth first order from the start state */
+	int * order;
+	int order_count;
+
+	/* how each state was first reached */
+	int * parent;
+	int * symbol;
+	int * depth;
+
+	/* the states accepting each movement, in breadth first order */
+	int ** accepting;
+	int * accepting_count;
+
+	int * used;
+	int * fallback;
+
+	int problems;
+} Checker;
+
+static int checker_accepts(Checker * self, int state, int movement_id) {
+	return MATCHER_TEST(&self->matcher->accept[state * self->matcher->accept_words],
+			movement_id);
+}
+
+static void checker_explore(Checker * self) {
+
+	Matcher * matcher = self->matcher;
+	int state_count = matcher->state_count;
+
+	self->order = malloc(sizeof(int) * state_count);
+	self->parent = malloc(sizeof(int) * state_count);
+	self->symbol = malloc(sizeof(int) * state_count);
+	self->depth = malloc(sizeof(int) * state_count);
+
+	for (int s = 0; s < state_count; ++s) {
+		self->parent[s] = -2;
+	}
+
+	self->parent[MATCHER_START_STATE] = -1;
+	self->depth[MATCHER_START_STATE] = 0;
+	self->order[self->order_count++] = MATCHER_START_STATE;
+
+	for (int i = 0; i < self->order_count; ++i) {
+
+		int state = self->order[i];
+
+		/* NONE is not a stroke */
+		for (int symbol = 1; symbol < STROKES_COUNT; ++symbol) {
+
+			int next = matcher->transitions[state * STROKES_COUNT + symbol];
+
+			if (next == MATCHER_DEAD_STATE || self->parent[next] != -2) {
+				continue;
+			}
+
+			self->parent[next] = state;
+			self->symbol[next] = symbol;
+			self->depth[next] = self->depth[state] + 1;
+			self->order[self->order_count++] = next;
+		}
+	}
+
+	int movement_count = self->conf->movement_count;
+
+	self->accepting = calloc(movement_count + 1, sizeof(int *));
+	self->accepting_count = calloc(movement_count + 1, sizeof(int));
+
+	for (int m = 0; m < movement_count; ++m) {
+		self->accepting[m] = malloc(sizeof(int) * self->order_count);
+	}
+
+	for (int i = 0; i < self->order_count; ++i) {
+		int state = self->order[i];
+		for (int m = 0; m < movement_count; ++m) {
+			if (checker_accepts(self, state, m)) {
+				self->accepting[m][self->accepting_count[m]++] = state;
+			}
+		}
+	}
+}
+
+/* the shortest sequence reaching 'state'. Must be freed */
+static char * checker_example(Checker * self, int state) {
+
+	char * example = malloc(self->depth[state] + 1);
+	example[self->depth[state]] = '\0';
+
+	for (int s = state; self->parent[s] >= 0; s = self->parent[s]) {
+		example[self->depth[s] - 1] = stroke_representations[self->symbol[s]];
+	}
+
+	return example;
+}
+
+/* if every sequence accepted by 'inner' is accepted by 'outer' */
+static int checker_includes(Checker * self, int outer, int inner) {
+
+	for (int i = 0; i < self->accepting_count[inner]; ++i) {
+		if (!checker_accepts(self, self->accepting[inner][i], outer)) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* the first state accepting both movements, or -1 */
+static int checker_overlap(Checker * self, int a, int b) {
+
+	for (int i = 0; i < self->accepting_count[b]; ++i) {
+		if (checker_accepts(self, self->accepting[b][i], a)) {
+			return self->accepting[b][i];
+		}
+	}
+
+	return -1;
+}
+
+/* the automaton doesn't know about the movements matched with regexec */
+static int checker_analyzed(Checker * self, Movement * movement) {
+	return movement && movement->valid && !self->fallback[movement->id];
+}
+
+static void check_movements(Checker * self) {
+
+	Configuration * conf = self->conf;
+
+	for (int m = 0; m < conf->movement_count; ++m) {
+
+		Movement * movement = &conf->movement_list[m];
+
+		if (!checker_analyzed(self, movement) || self->accepting_count[m]) {
+			continue;
+		}
+
+		printf("line %d: movement '%s' never matches any sequence%s\n",
+				movement->line, movement->name,
+				self->used[m] ? "" : " (unused)");
+
+		if (self->used[m]) {
+			self->problems++;
+		}
+	}
+}
+
+/*
+ * A gesture is never matched if an earlier gesture of its context matches
+ * every sequence it would match.
+ */
+static void check_gestures(Checker * self) {
+
+	Configuration * conf = self->conf;
+
+	for (int c = 0; c < conf->context_count; ++c) {
+
+		Context * context = &conf->context_list[c];
+
+		for (int g = 0; g < context->gesture_count; ++g) {
+
+			Gesture * gest = &context->gesture_list[g];
+
+			if (!gest->movement) {
+				/* reported by the parser */
+				continue;
+			}
+
+			if (!gest->movement->valid) {
+				printf(
+						"line %d: gesture '%s' in context '%s' uses the invalid movement '%s'\n",
+						gest->line, gest->name, context->name,
+						gest->movement->name);
+				self->problems++;
+				continue;
+			}
+
+			/* movements matching nothing are reported by check_movements */
+			if (!checker_analyzed(self, gest->movement)
+					|| !self->accepting_count[gest->movement->id]) {
+				continue;
+			}
+
+			for (int e = 0; e < g; ++e) {
+
+				Gesture * earlier = &context->gesture_list[e];
+
+				if (!checker_analyzed(self, earlier->movement)
+						|| !checker_includes(self, earlier->movement->id,
+								gest->movement->id)) {
+					continue;
+				}
+
+				printf(
+						"line %d: gesture '%s' in context '%s' is never matched: every sequence of '%s' is matched first by gesture '%s' (line %d)\n",
+						gest->line, gest->name, context->name,
+						gest->movement->name, earlier->name, earlier->line);
+				self->problems++;
+				break;
+			}
+		}
+	}
+}
+
+/* movements used by gestures that accept some of the same sequences */
+static void check_overlaps(Checker * self) {
+
+	Configuration * conf = self->conf;
+	int printed = 0;
+
+	for (int a = 0; a < conf->movement_count; ++a) {
+
+		Movement * ma = &conf->movement_list[a];
+
+		if (!self->used[a] || !checker_analyzed(self, ma)) {
+			continue;
+		}
+
+		for (int b = a + 1; b < conf->movement_count; ++b) {
+
+			Movement * mb = &conf->movement_list[b];
+
+			if (!self->used[b] || !checker_analyzed(self, mb)) {
+				continue;
+			}
+
+			int state = checker_overlap(self, a, b);
+
+			if (state < 0) {
+				continue;
+			}
+
+			int a_includes_b = checker_includes(self, a, b);
+			int b_includes_a = checker_includes(self, b, a);
+
+			const char * relation = "overlaps";
+			Movement * first = ma;
+			Movement * second = mb;
+
+			if (a_includes_b && b_includes_a) {
+				relation = "is the same as";
+			} else if (a_includes_b) {
+				relation = "includes";
+			} else if (b_includes_a) {
+				relation = "includes";
+				first = mb;
+				second = ma;
+			}
+
+			if (!printed) {
+				printf("\nMovements matching the same sequences:\n");
+				printed = 1;
+			}
+
+			char * example = checker_example(self, state);
+			printf("  '%s' (line %d) %s '%s' (line %d), e.g. \"%s\"\n",
+					first->name, first->line, relation, second->name,
+					second->line, example);
+			free(example);
+		}
+	}
+}
+
+/*
+ * Time what match_gesture does for the shortest sequence of each gesture,
+ * in its context: run the automaton and test the movements of the context
+ * in order, until the gesture.
+ */
+static void check_costs(Checker * self) {
+
+	Configuration * conf = self->conf;
+
+	printf("\nMatch cost of each gesture, for its shortest sequence:\n");
+	printf("  %6s %6s %8s  %s\n", "line", "tests", "ns", "gesture");
+
+	for (int c = 0; c < conf->context_count; ++c) {
+
+		Context * context = &conf->context_list[c];
+
+		for (int g = 0; g < context->gesture_count; ++g) {
+
+			Gesture * gest = &context->gesture_list[g];
+			Movement * movement = gest->movement;
+
+			if (!checker_analyzed(self, movement)
+					|| !self->accepting_count[movement->id]) {
+				continue;
+			}
+
+			char * example = checker_example(self,
+					self->accepting[movement->id][0]);
+
+			struct timespec start, end;
+			int tests = 0;
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+
+			for (int run = 0; run < CHECK_MATCH_RUNS; ++run) {
+
+				int state = matcher_run(self->matcher, MATCHER_START_STATE,
+						example);
+				const unsigned int * matches = matcher_match_state(
+						self->matcher, state, example);
+
+				for (tests = 0; tests < context->gesture_count; ++tests) {
+					Movement * tested = context->gesture_list[tests].movement;
+					if (tested && MATCHER_TEST(matches, tested->id)) {
+						break;
+					}
+				}
+			}
+
+			clock_gettime(CLOCK_MONOTONIC, &end);
+
+			long ns = ((end.tv_sec - start.tv_sec) * 1000000000L
+					+ (end.tv_nsec - start.tv_nsec)) / CHECK_MATCH_RUNS;
+
+			printf("  %6d %6d %8ld  '%s' on '%s', e.g. \"%s\"\n", gest->line,
+					tests + 1, ns, gest->name, context->name, example);
+
+			free(example);
+		}
+	}
+}
+
+static void checker_free(Checker * self) {
+
+	for (int m = 0; self->accepting && m < self->conf->movement_count; ++m) {
+		free(self->accepting[m]);
+	}
+
+	free(self->accepting);
+	free(self->accepting_count);
+	free(self->order);
+	free(self->parent);
+	free(self->symbol);
+	free(self->depth);
+	free(self->used);
+	free(self->fallback);
+}
+
+/*
+ * Print what can't work in a configuration, and what the matcher costs.
+ * Returns the number of problems, including the ones found while loading.
+ */
+int configuration_check(Configuration * self) {
+
+	Checker checker;
+	memset(&checker, 0, sizeof(Checker));
+
+	checker.conf = self;
+	checker.matcher = self->matcher;
+
+	printf("\nConfiguration: %d movements, %d contexts, %d gestures, %d actions in %zu KB\n",
+			self->movement_count, self->context_count, self->gesture_count,
+			self->action_count, self->arena->used / 1024);
+
+	if (!checker.matcher) {
+		printf("Matcher: movements too complex to be combined, each one is matched with regexec.\n");
+		printf("\n%d problems found.\n", self->warning_count);
+		return self->warning_count;
+	}
+
+	Matcher * matcher = checker.matcher;
+
+	printf("Matcher: %d states, %zu KB of transitions, %zu KB of match sets, %d movements matched with regexec\n",
+			matcher->state_count,
+			(size_t) matcher->state_count * STROKES_COUNT * sizeof(int) / 1024,
+			(size_t) matcher->state_count * matcher->accept_words
+					* sizeof(unsigned int) * 2 / 1024,
+			matcher->fallback_count);
+
+	checker.used = calloc(self->movement_count + 1, sizeof(int));
+	checker.fallback = calloc(self->movement_count + 1, sizeof(int));
+
+	for (int g = 0; g < self->gesture_count; ++g) {
+		if (self->gesture_list[g].movement) {
+			checker.used[self->gesture_list[g].movement->id] = 1;
+		}
+	}
+
+	for (int i = 0; i < matcher->fallback_count; ++i) {
+		Movement * movement = matcher->fallback_list[i];
+		checker.fallback[movement->id] = 1;
+		printf("line %d: movement '%s' is matched with regexec, it is not checked\n",
+				movement->line, movement->name);
+	}
+
+	checker_explore(&checker);
+
+	printf("\n");
+
+	check_movements(&checker);
+	check_gestures(&checker);
+	check_overlaps(&checker);
+	check_costs(&checker);
+
+	int problems = self->warning_count + checker.problems;
+
+	printf("\n%d problems found.\n", problems);
+
+	checker_free(&checker);
+
+	return problems;
+}
@@ -0,0 +1,24 @@
+/*
+ Copyright 2016 Lucas Augusto Deters
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2, or (at your option)
+ any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ one line to give the program's name and an idea of what it does.
+ */
+
+#ifndef MYGESTURES_CONFIGURATIONCHECK_H_
+#define MYGESTURES_CONFIGURATIONCHECK_H_
+
+#include "configuration.h"
+
+int configuration_check(Configuration * self);
+
+#endif
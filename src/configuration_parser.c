@@ -18,317 +18,521 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include <libxml/tree.h>
+#include <libxml/xmlreader.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <stdarg.h>
+#include <time.h>
 
 #include "assert.h"
 
 #include "config.h"
 #include "actions.h"
 #include "configuration_parser.h"
+#include "configuration_cache.h"
 
 const char * CONFIG_FILE_NAME = "mygestures.xml";
 
-void xml_parse_action(xmlNode *node, Gesture * gest) {
+/* longest attribute value accepted, bigger ones are reported and ignored */
+#define XML_MAX_VALUE GEST_EXTRA_DATA_MAX
 
-	assert(node);
-	assert(gest);
+/* movement, context, gesture and do. anything deeper is skipped */
+#define XML_MAX_DEPTH 3
 
-	Action * action = NULL;
+/*
+ * The elements are read one at a time with an xmlTextReader, and added to
+ * the configuration as soon as their attributes are read. Only the current
+ * element is kept in memory.
+ */
+typedef struct xml_reader_state_ {
+	xmlTextReaderPtr reader;
+	const char * filename;
+	Configuration * conf;
+
+	/* the whole file, mapped. Used to find the columns of the elements */
+	const char * data;
+	size_t size;
+
+	/* where the elements at the next depth are added, NULL to skip them */
+	Context * context;
+	Gesture * gesture;
+
+	int errors;
+} XmlReaderState;
 
-	char * action_name = NULL;
-	char * action_value = NULL;
+/*
+ * The position of the current element. The parser reads ahead of the
+ * reader, and libxml2 only keeps the line of each node, so the column is
+ * where the element starts on that line.
+ */
+static void xml_position(XmlReaderState * state, long * line, long * column) {
+
+	xmlNodePtr node = xmlTextReaderCurrentNode(state->reader);
+	const char * element = (const char *) xmlTextReaderConstName(state->reader);
 
-	xmlAttr* attribute = node->properties;
+	*line = node ? xmlGetLineNo(node) : -1;
+	*column = 1;
 
-	while (attribute && attribute->name && attribute->children) {
+	if (*line < 1) {
+		*line = xmlTextReaderGetParserLineNumber(state->reader);
+		return;
+	}
 
-		char * name = (char *) attribute->name;
-		char * value = (char *) xmlNodeListGetString(node->doc,
-				attribute->children, 1);
+	const char * start = state->data;
+	const char * end = state->data + state->size;
 
-		if (strcasecmp(name, "action") == 0) {
-			action_name = strdup(value);
-		} else if (strcasecmp(name, "value") == 0) {
-			action_value = strdup(value);
+	for (long l = 1; l < *line; ++l) {
+		start = memchr(start, '\n', end - start);
+		if (!start) {
+			return;
 		}
+		start++;
+	}
+
+	const char * eol = memchr(start, '\n', end - start);
+	size_t length = element ? strlen(element) : 0;
 
-		xmlFree(value);
-		attribute = attribute->next;
+	if (!eol) {
+		eol = end;
 	}
 
-	if (!action_name) {
-		free(action_value);
-		printf("Missing action name at line %d\n", node->line);
-		return;
+	for (const char * c = start; c + length < eol; ++c) {
+		if (*c == '<' && strncmp(c + 1, element, length) == 0) {
+			*column = c - start + 1;
+			return;
+		}
 	}
+}
+
+/* the line of the current element, cheaper than xml_position */
+static int xml_line(XmlReaderState * state) {
 
-	int id = ACTION_NULL;
+	xmlNodePtr node = xmlTextReaderCurrentNode(state->reader);
+
+	return node ? xmlGetLineNo(node) : 0;
+}
+
+/* a problem with the current element, with its line and column */
+static void xml_report(XmlReaderState * state, const char * format, ...) {
+
+	va_list args;
+	long line, column;
+
+	state->conf->warning_count++;
+
+	xml_position(state, &line, &column);
+
+	printf("%s:%ld:%ld: ", state->filename, line, column);
+
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+
+	printf("\n");
+}
+
+/* errors found by libxml2, like a malformed file */
+static void xml_error(void * data, xmlErrorPtr error) {
+
+	XmlReaderState * state = data;
+
+	fprintf(stderr, "%s:%d:%d: %s", state->filename, error->line, error->int2,
+			error->message);
+
+	state->conf->warning_count++;
+
+	if (error->level >= XML_ERR_ERROR) {
+		state->errors++;
+	}
+}
+
+/*
+ * Copy the values of the attributes of the current element named as in
+ * 'names', ignoring the case. Values not found are NULL. Every value must
+ * be freed with xmlFree.
+ */
+static void xml_read_attributes(XmlReaderState * state, const char ** names,
+		xmlChar ** values, int count) {
+
+	memset(values, 0, sizeof(xmlChar *) * count);
+
+	while (xmlTextReaderMoveToNextAttribute(state->reader) == 1) {
+
+		const char * name = (const char *) xmlTextReaderConstName(
+				state->reader);
+
+		for (int i = 0; i < count; ++i) {
+
+			if (values[i] || strcasecmp(name, names[i]) != 0) {
+				continue;
+			}
+
+			values[i] = xmlTextReaderValue(state->reader);
+
+			if (values[i] && strlen((char *) values[i]) > XML_MAX_VALUE) {
+				xml_report(state, "value of '%s' is too long, ignored", name);
+				xmlFree(values[i]);
+				values[i] = NULL;
+			}
+
+			break;
+		}
+	}
+
+	xmlTextReaderMoveToElement(state->reader);
+}
+
+static void xml_free_attributes(xmlChar ** values, int count) {
+	for (int i = 0; i < count; ++i) {
+		xmlFree(values[i]);
+	}
+}
+
+static int xml_action_id(const char * action_name) {
 
 	if (strcasecmp(action_name, "iconify") == 0) {
-		id = ACTION_ICONIFY;
+		return ACTION_ICONIFY;
 	} else if (strcasecmp(action_name, "kill") == 0) {
-		id = ACTION_KILL;
+		return ACTION_KILL;
 	} else if (strcasecmp(action_name, "lower") == 0) {
-		id = ACTION_LOWER;
+		return ACTION_LOWER;
 	} else if (strcasecmp(action_name, "raise") == 0) {
-		id = ACTION_RAISE;
+		return ACTION_RAISE;
 	} else if (strcasecmp(action_name, "maximize") == 0) {
-		id = ACTION_MAXIMIZE;
+		return ACTION_MAXIMIZE;
 	} else if (strcasecmp(action_name, "restore") == 0) {
-		id = ACTION_RESTORE;
+		return ACTION_RESTORE;
 	} else if (strcasecmp(action_name, "toggle-maximized") == 0) {
-		id = ACTION_TOGGLE_MAXIMIZED;
+		return ACTION_TOGGLE_MAXIMIZED;
 	} else if (strcasecmp(action_name, "keypress") == 0) {
-		id = ACTION_KEYPRESS;
+		return ACTION_KEYPRESS;
 	} else if (strcasecmp(action_name, "exec") == 0) {
-		id = ACTION_EXECUTE;
-	} else {
-		printf("unknown action '%s' at line %d\n", action_name, node->line);
-		free(action_name);
-		free(action_value);
-		return;
+		return ACTION_EXECUTE;
+	} else if (strcasecmp(action_name, "toggle-fullscreen") == 0) {
+		return ACTION_TOGGLE_FULLSCREEN;
+	} else if (strcasecmp(action_name, "toggle-sticky") == 0) {
+		return ACTION_TOGGLE_STICKY;
+	} else if (strcasecmp(action_name, "toggle-above") == 0) {
+		return ACTION_TOGGLE_ABOVE;
+	} else if (strcasecmp(action_name, "toggle-below") == 0) {
+		return ACTION_TOGGLE_BELOW;
+	} else if (strcasecmp(action_name, "next-desktop") == 0) {
+		return ACTION_NEXT_DESKTOP;
+	} else if (strcasecmp(action_name, "previous-desktop") == 0) {
+		return ACTION_PREVIOUS_DESKTOP;
+	} else if (strcasecmp(action_name, "desktop") == 0) {
+		return ACTION_DESKTOP;
+	} else if (strcasecmp(action_name, "reload") == 0) {
+		return ACTION_RECONF;
 	}
 
-	if (!action_value) {
-		action_value = "";
-	}
-
-	configuration_create_action(gest, id, action_value);
-
+	return ACTION_NULL;
 }
 
-static Gesture * xml_parse_gesture(xmlNode *node, Context * context) {
+static void xml_read_action(XmlReaderState * state) {
 
-	assert(node);
-	assert(context);
+	static const char * names[] = { "action", "value", "delay" };
+	xmlChar * values[3];
 
-	char * gesture_name = NULL;
-	char * gesture_movement = NULL;
+	xml_read_attributes(state, names, values, 3);
 
-	xmlAttr* attribute = node->properties;
-	while (attribute && attribute->name && attribute->children) {
+	char * action_name = (char *) values[0];
+	char * action_value = (char *) values[1];
 
-		char * name = (char *) attribute->name;
-		char * value = (char *) xmlNodeListGetString(node->doc,
-				attribute->children, 1);
-
-		if (strcasecmp(name, "name") == 0) {
-			gesture_name = strdup(value);
-		} else if (strcasecmp(name, "movement") == 0) {
-			gesture_movement = strdup(value);
-		}
-		xmlFree(value);
-		attribute = attribute->next;
+	if (!action_name) {
+		xml_report(state, "missing action name");
+		xml_free_attributes(values, 3);
+		return;
 	}
 
-	if (!gesture_name) {
-		printf("missing gesture name at line %d\n", node->line);
-		free(gesture_movement);
-		return NULL;
-	}
+	int id = xml_action_id(action_name);
 
-	if (!gesture_movement) {
-		printf("missing gesture movement at line %d\n", node->line);
-		free(gesture_name);
-		return NULL;
+	if (id == ACTION_NULL) {
+		xml_report(state, "unknown action '%s'", action_name);
+		xml_free_attributes(values, 3);
+		return;
 	}
 
-	Gesture * gest = configuration_create_gesture(context, gesture_name,
-			gesture_movement);
+	/* the configuration keeps its own copy of the strings */
+	Action * action = configuration_create_action(state->gesture, id,
+			action_value ? action_value : "");
 
-	xmlNode *cur_node = NULL;
+	if (values[2] && atoi((char *) values[2]) > 0) {
+		action->key_delay = atoi((char *) values[2]);
+	}
+
+	xml_free_attributes(values, 3);
+}
 
-	for (cur_node = node->children; cur_node; cur_node = cur_node->next) {
-		if (cur_node->type == XML_ELEMENT_NODE) {
+static Gesture * xml_read_gesture(XmlReaderState * state) {
 
-			char * element = (char *) cur_node->name;
+	static const char * names[] = { "name", "movement" };
+	xmlChar * values[2];
 
-			if (strcasecmp(element, "do") == 0) {
+	xml_read_attributes(state, names, values, 2);
 
-				xml_parse_action(cur_node, gest);
+	char * gesture_name = (char *) values[0];
+	char * gesture_movement = (char *) values[1];
 
-			} else {
-				printf("unknown tag '%s' at line %d\n", element,
-						cur_node->line);
-			}
+	Gesture * gest = NULL;
 
+	if (!gesture_name) {
+		xml_report(state, "missing gesture name");
+	} else if (!gesture_movement) {
+		xml_report(state, "missing gesture movement");
+	} else {
+		gest = configuration_create_gesture(state->context, gesture_name,
+				gesture_movement);
+		gest->line = xml_line(state);
+
+		if (gest->movement_id < 0) {
+			xml_report(state,
+					"movement '%s' referenced by gesture '%s' is unknown. The gesture will be inaccessible",
+					gesture_movement, gesture_name);
 		}
 	}
 
-	return gest;
+	xml_free_attributes(values, 2);
 
+	return gest;
 }
 
-static Context * xml_parse_context(xmlNode *node, Configuration * eng) {
+static Context * xml_read_context(XmlReaderState * state) {
 
-	char * context_name = NULL;
-	char * window_title = NULL;
-	char * window_class = NULL;
+	static const char * names[] = { "name", "windowtitle", "windowclass" };
+	xmlChar * values[3];
 
-	xmlAttr* attribute = node->properties;
-	while (attribute && attribute->name && attribute->children) {
-		char * name = (char *) attribute->name;
-		char * value = (char *) xmlNodeListGetString(node->doc,
-				attribute->children, 1);
+	xml_read_attributes(state, names, values, 3);
 
-		if (strcasecmp(name, "name") == 0) {
-			context_name = strdup(value);
-		} else if (strcasecmp(name, "windowtitle") == 0) {
-			window_title = strdup(value);
-		} else if (strcasecmp(name, "windowclass") == 0) {
-			window_class = strdup(value);
-		}
-		xmlFree(value);
-		attribute = attribute->next;
-	}
+	char * context_name = (char *) values[0];
+	char * window_title = (char *) values[1];
+	char * window_class = (char *) values[2];
 
-	// TODO: criar o context e só depois ir adicionando os elementos.
+	Context * ctx = NULL;
 
 	if (!context_name) {
-		printf("Missing context name\n");
-		free(window_title);
-		free(window_class);
-		return NULL;
+		xml_report(state, "missing context name");
+	} else {
+		ctx = configuration_create_context(state->conf, context_name,
+				window_title ? window_title : "",
+				window_class ? window_class : "");
+		ctx->line = xml_line(state);
 	}
 
-	if (!window_class) {
-		window_class = "";
-	}
+	xml_free_attributes(values, 3);
+
+	return ctx;
+}
+
+static void xml_read_movement(XmlReaderState * state) {
+
+	static const char * names[] = { "name", "value" };
+	xmlChar * values[2];
+
+	xml_read_attributes(state, names, values, 2);
 
-	if (!window_title) {
-		window_title = "";
+	char * movement_name = (char *) values[0];
+	char * movement_strokes = (char *) values[1];
+
+	if (!movement_name) {
+		xml_report(state, "missing movement name");
+	} else if (!movement_strokes) {
+		xml_report(state, "missing movement value");
+	} else {
+		Movement * movement = configuration_create_movement(state->conf,
+				movement_name, movement_strokes);
+		movement->line = xml_line(state);
 	}
 
-	Context * ctx = configuration_create_context(eng, context_name,
-			window_title, window_class);
+	xml_free_attributes(values, 2);
+}
 
-	/* now process the gestures */
+/*
+ * Handle an element start. Returns 1 if the children of the element must be
+ * skipped.
+ */
+static int xml_read_element(XmlReaderState * state) {
 
-	xmlNode *cur_node = NULL;
+	int depth = xmlTextReaderDepth(state->reader);
+	const char * element = (const char *) xmlTextReaderConstName(
+			state->reader);
 
-	for (cur_node = node->children; cur_node; cur_node = cur_node->next) {
-		if (cur_node->type == XML_ELEMENT_NODE) {
+	/* the root element, whatever its name */
+	if (depth == 0) {
+		return 0;
+	}
 
-			char * element = (char *) cur_node->name;
+	if (depth == 1) {
 
-			if (strcasecmp(element, "gesture") == 0) {
+		state->context = NULL;
+		state->gesture = NULL;
 
-				Gesture * gest = xml_parse_gesture(cur_node, ctx);
+		if (strcasecmp(element, "movement") == 0) {
+			xml_read_movement(state);
+			return 1;
+		}
 
-			} else {
-				printf("unknown tag '%s' at line %d\n", element,
-						cur_node->line);
-			}
+		if (strcasecmp(element, "context") == 0) {
+			state->context = xml_read_context(state);
+			return !state->context;
 		}
 
-	}
+	} else if (depth == 2) {
 
-	return ctx;
+		state->gesture = NULL;
 
-}
+		if (strcasecmp(element, "gesture") == 0) {
+			state->gesture = xml_read_gesture(state);
+			return !state->gesture;
+		}
 
-void xml_parse_movement(xmlNode *node, Configuration * eng) {
+	} else if (depth == 3) {
 
-	assert(node);
-	assert(eng);
+		if (strcasecmp(element, "do") == 0) {
+			xml_read_action(state);
+			return 1;
+		}
 
-	//xmlNode *cur_node = NULL;
+	} else {
+		return 1;
+	}
 
-	char * movement_name = NULL;
-	char * movement_strokes = NULL;
+	xml_report(state, "unknown tag '%s'", element);
+
+	return 1;
+}
+
+/*
+ * Entities are never expanded and nothing is loaded from the network, and
+ * the size limits of libxml2 are kept, so a generated or hostile file can't
+ * make the parser use unbounded memory. Returns 0 on success.
+ */
+static int configuration_read_xml(Configuration * conf, const char * filename) {
 
-	Movement * movement = NULL;
+	XmlReaderState state;
+	memset(&state, 0, sizeof(XmlReaderState));
 
-	xmlAttr* attribute = node->properties;
-	while (attribute && attribute->name && attribute->children) {
+	state.filename = filename;
+	state.conf = conf;
 
-		char * name = (char *) attribute->name;
-		char * value = (char *) xmlNodeListGetString(node->doc,
-				attribute->children, 1);
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	struct stat st;
 
-		if (strcasecmp(name, "name") == 0) {
-			movement_name = strdup(value);
-		} else if (strcasecmp(name, "value") == 0) {
-			movement_strokes = strdup(value);
+	if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+		fprintf(stderr, "%s: can't be read\n", filename);
+		if (fd >= 0) {
+			close(fd);
 		}
-		xmlFree(value);
-		attribute = attribute->next;
+		return 1;
 	}
 
-	if (!movement_name) {
-		printf("missing movement name at line %d\n", node->line);
-		free(movement_strokes);
-		return;
-	}
+	state.size = st.st_size;
+	state.data = mmap(NULL, state.size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
 
-	if (!movement_strokes) {
-		printf("missing movement value at line %d\n", node->line);
-		free(movement_name);
-		return;
+	if (state.data == MAP_FAILED) {
+		perror("In mmap()");
+		return 1;
 	}
 
-	configuration_create_movement(eng, movement_name, movement_strokes);
+	int options = XML_PARSE_NONET | XML_PARSE_NOCDATA;
 
-}
+#if LIBXML_VERSION >= 20900
+	/* generated configurations can be longer than 65535 lines */
+	options |= XML_PARSE_BIG_LINES;
+#endif
 
-void xml_parse_root(xmlNode *node, Configuration * eng) {
+	state.reader = xmlReaderForMemory(state.data, state.size, filename, NULL,
+			options);
 
-	assert(node);
-	assert(eng);
+	if (!state.reader) {
+		fprintf(stderr, "%s: can't be read\n", filename);
+		munmap((void *) state.data, state.size);
+		return 1;
+	}
 
-	xmlNode *cur_node = NULL;
+	xmlTextReaderSetStructuredErrorHandler(state.reader, xml_error, &state);
 
-	int gestures_count = 0;
-	int contexts_count = 0;
+	int elements = 0;
+	int ret = xmlTextReaderRead(state.reader);
 
-	for (cur_node = node->children; cur_node; cur_node = cur_node->next) {
-		if (cur_node->type == XML_ELEMENT_NODE) {
+	while (ret == 1) {
 
-			char * element = (char *) cur_node->name;
+		int skip = 0;
 
-			if (strcasecmp(element, "movement") == 0) {
+		if (xmlTextReaderNodeType(state.reader) == XML_READER_TYPE_ELEMENT) {
+			elements++;
+			skip = xml_read_element(&state);
+		}
 
-				xml_parse_movement(cur_node, eng);
+		if (skip) {
+			ret = xmlTextReaderNext(state.reader);
+		} else {
+			ret = xmlTextReaderRead(state.reader);
+		}
+	}
 
-			} else if (strcasecmp(element, "context") == 0) {
+	xmlFreeTextReader(state.reader);
+	munmap((void *) state.data, state.size);
 
-				Context * ctx = xml_parse_context(cur_node, eng);
-				gestures_count += ctx->gesture_count;
-				contexts_count += 1;
+	if (ret != 0 || state.errors || !elements) {
+		fprintf(stderr, "%s: the configuration is incomplete\n", filename);
+		return 1;
+	}
 
-			} else {
-				printf("unknown tag '%s' at line %d\n", element,
-						cur_node->line);
-			}
+	return 0;
+}
 
-		}
+static void print_load_time(struct timespec * start, const char * source) {
 
-	}
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
 
+	printf("Configuration read from %s in %ld us.\n", source,
+			(end.tv_sec - start->tv_sec) * 1000000
+					+ (end.tv_nsec - start->tv_nsec) / 1000);
 }
 
-static int configuration_parse_file(Configuration * conf, char * filename) {
-	int result = 0;
+/*
+ * Use the cache written the last time the file was parsed, if the file
+ * didn't change since then and 'use_cache' is set. Otherwise parse it, and
+ * write a new cache if 'use_cache' is set.
+ */
+static int configuration_parse_file(Configuration * conf, char * filename,
+		int use_cache) {
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	conf->filename = arena_intern(conf->arena, filename);
+
+	CacheKey key;
+	int has_key = configuration_cache_key(filename, &key) == 0;
+
+	if (use_cache && has_key
+			&& configuration_cache_load(conf, filename, &key) == 0) {
+		print_load_time(&start, "cache");
+		return 0;
+	}
 
-	xmlDocPtr doc = NULL;
-	xmlNode *root_element = NULL;
+	int err = configuration_read_xml(conf, filename);
 
-	doc = xmlParseFile(filename);
+	/* what was read before an error is still used */
+	configuration_freeze(conf);
 
-	if (!doc) {
-		perror("Empty file.\n");
+	if (err) {
 		return 1;
 	}
 
-	root_element = xmlDocGetRootElement(doc);
-	xml_parse_root(root_element, conf);
+	print_load_time(&start, "XML");
 
-	xmlFreeDoc(doc);
-	xmlCleanupParser();
+	/* a configuration in a read only directory is just not cached */
+	if (use_cache && has_key) {
+		configuration_cache_save(conf, filename, &key);
+	}
 
 	return 0;
 
@@ -447,7 +651,7 @@ void configuration_load_from_defaults(Configuration * configuration) {
 		fclose(f);
 	}
 
-	err = configuration_parse_file(configuration, config_file);
+	err = configuration_parse_file(configuration, config_file, 1);
 
 	if (err) {
 		fprintf(stderr, "Error loading configuration from file \n'%s'\n\n",
@@ -458,18 +662,27 @@ void configuration_load_from_defaults(Configuration * configuration) {
 
 }
 
-void configuration_load_from_file(Configuration * configuration, char * filename) {
+int configuration_load_from_file(Configuration * configuration, char * filename) {
 
 	int err = 0;
 
-	err = configuration_parse_file(configuration, filename);
+	err = configuration_parse_file(configuration, filename, 1);
 
 	if (err) {
 		printf("Error loading custom configuration from '%s'\n", filename);
-		return;
+		return err;
 	}
 
 	printf("Loaded %i gestures from \n'%s'.\n",
 			configuration_get_gestures_count(configuration), filename);
 
+	return 0;
+}
+
+/*
+ * Always parse the file, so every problem in it is reported, and leave the
+ * cache alone. Used by the --check mode.
+ */
+int configuration_load_uncached(Configuration * configuration, char * filename) {
+	return configuration_parse_file(configuration, filename, 0);
 }
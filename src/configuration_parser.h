@@ -21,7 +21,8 @@
 
 char * configuration_get_default_filename();
 
-void configuration_load_from_file(Configuration * configuration, char * filename);
+int configuration_load_from_file(Configuration * configuration, char * filename);
+int configuration_load_uncached(Configuration * configuration, char * filename);
 void configuration_load_from_defaults(Configuration * configuration);
 
 #endif
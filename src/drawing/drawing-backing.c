@@ -14,7 +14,12 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/Xatom.h>
+#include <X11/extensions/shape.h>
 
 #include "drawing-backing.h"
 
@@ -22,7 +27,16 @@
 #include "dmalloc.h"
 #endif
 
-int backing_init(backing_t *backing, Display *dpy, Window root, int width, int height, int depth) {
+#define WORD_BITS (sizeof(unsigned long) * 8)
+#define TILE_WORDS(backing) (((backing)->tiles_x * (backing)->tiles_y + WORD_BITS - 1) / WORD_BITS)
+#define TILE_TEST(bits, i) (((bits)[(i) / WORD_BITS] >> ((i) % WORD_BITS)) & 1)
+#define TILE_SET(bits, i) ((bits)[(i) / WORD_BITS] |= 1UL << ((i) % WORD_BITS))
+
+/* The state, GC and Render formats shared by the root window and the
+ overlay. Nothing is drawn on yet.
+ */
+static void backing_init_common(backing_t *backing, Display *dpy, Window root, int width,
+		int height, int depth) {
 
 	XRenderPictFormat templ;
 	int screen = DefaultScreen(dpy);
@@ -46,6 +60,23 @@ int backing_init(backing_t *backing, Display *dpy, Window root, int width, int h
 	backing->root_pict = 0;
 	backing->brush_pict = 0;
 
+	backing->tiles_x = 0;
+	backing->tiles_y = 0;
+	backing->saved = NULL;
+	backing->pending = NULL;
+	backing->saved_count = 0;
+	backing->pending_count = 0;
+	backing->rects = NULL;
+	backing->rects_size = 0;
+	backing->bytes_copied = 0;
+	backing->tiles_saved = 0;
+
+	backing->overlay = None;
+	backing->overlay_colormap = None;
+	backing->overlay_visual = NULL;
+	backing->opacity_atom = None;
+	backing->raster = NULL;
+
 	backing->root_format = XRenderFindVisualFormat(dpy, DefaultVisual(dpy, screen));
 
 	templ.type = PictTypeDirect;
@@ -69,6 +100,80 @@ int backing_init(backing_t *backing, Display *dpy, Window root, int width, int h
 	PictFormatGreenMask |
 	PictFormatBlue |
 	PictFormatBlueMask, &templ, 0);
+}
+
+int backing_init(backing_t *backing, Display *dpy, Window root, int width, int height, int depth) {
+
+	backing_init_common(backing, dpy, root, width, height, depth);
+
+	/* the pixmaps live as long as the backing, see backing_restore */
+	backing_reconfigure(backing, width, height, depth);
+
+	return 0;
+}
+
+/* Draw on a click-through, transparent window over everything. It only
+ looks right with a compositing manager, so it fails without one.
+ */
+int backing_init_overlay(backing_t *backing, Display *dpy, Window root, int width, int height) {
+
+	char selection[32];
+	int screen = DefaultScreen(dpy);
+	int event_base, error_base;
+	XVisualInfo vinfo;
+	XSetWindowAttributes attr;
+
+	snprintf(selection, sizeof(selection), "_NET_WM_CM_S%d", screen);
+
+	if (XGetSelectionOwner(dpy, XInternAtom(dpy, selection, False)) == None)
+		return 1;
+
+	if (!XShapeQueryExtension(dpy, &event_base, &error_base))
+		return 1;
+
+	if (!XMatchVisualInfo(dpy, screen, 32, TrueColor, &vinfo))
+		return 1;
+
+	/* the GC and the formats are the same as on the root window */
+	backing_init_common(backing, dpy, root, width, height, DefaultDepth(dpy, screen));
+
+	backing->overlay_colormap = XCreateColormap(dpy, root, vinfo.visual, AllocNone);
+	backing->overlay_visual = vinfo.visual;
+	backing->opacity_atom = XInternAtom(dpy, "_NET_WM_WINDOW_OPACITY", False);
+
+	attr.override_redirect = True;
+	attr.colormap = backing->overlay_colormap;
+	attr.background_pixel = 0;
+	attr.border_pixel = 0;
+
+	backing->overlay = XCreateWindow(dpy, root, 0, 0, width, height, 0, 32, InputOutput,
+			vinfo.visual, CWOverrideRedirect | CWColormap | CWBackPixel | CWBorderPixel, &attr);
+
+	/* events go through the window, to whatever is under it */
+	XShapeCombineRectangles(dpy, backing->overlay, ShapeInput, 0, 0, NULL, 0, ShapeSet, YXBanded);
+
+	backing->brush_pict = XRenderCreatePicture(dpy, backing->overlay,
+			XRenderFindVisualFormat(dpy, vinfo.visual), 0, 0);
+
+	return 0;
+}
+
+/* Draw the overlay in our own memory and only send the rows that changed.
+ Needs backing_init_overlay first.
+ */
+int backing_init_raster(backing_t *backing) {
+
+	if (!backing->overlay)
+		return 1;
+
+	backing->raster = malloc(sizeof(raster_t));
+	if (raster_init(backing->raster, backing->dpy, backing->overlay, backing->overlay_visual,
+			backing->total_width, backing->total_height)) {
+		raster_deinit(backing->raster);
+		free(backing->raster);
+		backing->raster = NULL;
+		return 1;
+	}
 
 	return 0;
 }
@@ -76,6 +181,22 @@ int backing_init(backing_t *backing, Display *dpy, Window root, int width, int h
 void backing_deinit(backing_t *backing) {
 
 	backing->active = 0;
+
+	if (backing->raster) {
+		raster_deinit(backing->raster);
+		free(backing->raster);
+		backing->raster = NULL;
+	}
+
+	if (backing->overlay) {
+		XRenderFreePicture(backing->dpy, backing->brush_pict);
+		backing->brush_pict = 0;
+		XDestroyWindow(backing->dpy, backing->overlay);
+		backing->overlay = None;
+		XFreeColormap(backing->dpy, backing->overlay_colormap);
+		backing->overlay_colormap = None;
+	}
+
 	XFreeGC(backing->dpy, backing->gc);
 	if (backing->root_pixmap) {
 		XFreePixmap(backing->dpy, backing->root_pixmap);
@@ -91,91 +212,306 @@ void backing_deinit(backing_t *backing) {
 		XRenderFreePicture(backing->dpy, backing->brush_pict);
 		backing->brush_pict = 0;
 	}
+
+	free(backing->saved);
+	backing->saved = NULL;
+	free(backing->pending);
+	backing->pending = NULL;
+	free(backing->rects);
+	backing->rects = NULL;
+	backing->rects_size = 0;
 }
 
-int backing_save(backing_t *backing, int x, int y) {
+static void backing_clear_tiles(backing_t *backing) {
+	memset(backing->saved, 0, sizeof(unsigned long) * TILE_WORDS(backing));
+	memset(backing->pending, 0, sizeof(unsigned long) * TILE_WORDS(backing));
+	backing->saved_count = 0;
+	backing->pending_count = 0;
+
+	backing->min_tx = backing->tiles_x;
+	backing->min_ty = backing->tiles_y;
+	backing->max_tx = -1;
+	backing->max_ty = -1;
+}
+
+/* Rectangles covering the tiles set in 'bits' inside the given tile range.
+ Neighbour tiles on the same row are joined. Returns the number of
+ rectangles, stored in backing->rects.
+ */
+static int backing_tile_rects(backing_t *backing, unsigned long *bits, int min_tx, int min_ty,
+		int max_tx, int max_ty, unsigned long *pixels) {
+	int tx, ty;
+	int count = 0;
+
+	if (min_tx < backing->min_tx)
+		min_tx = backing->min_tx;
+	if (min_ty < backing->min_ty)
+		min_ty = backing->min_ty;
+	if (max_tx > backing->max_tx)
+		max_tx = backing->max_tx;
+	if (max_ty > backing->max_ty)
+		max_ty = backing->max_ty;
+
+	for (ty = min_ty; ty <= max_ty; ty++) {
+		tx = min_tx;
+		while (tx <= max_tx) {
+			if (!TILE_TEST(bits, ty * backing->tiles_x + tx)) {
+				tx++;
+				continue;
+			}
+
+			int first = tx;
+			while (tx <= max_tx && TILE_TEST(bits, ty * backing->tiles_x + tx))
+				tx++;
+
+			if (count == backing->rects_size) {
+				backing->rects_size = backing->rects_size ? backing->rects_size * 2 : 64;
+				backing->rects = realloc(backing->rects,
+						sizeof(XRectangle) * backing->rects_size);
+			}
+
+			XRectangle *rect = &backing->rects[count++];
+			rect->x = first * BACKING_TILE;
+			rect->y = ty * BACKING_TILE;
+			rect->width = (tx - first) * BACKING_TILE;
+			rect->height = BACKING_TILE;
+
+			if (rect->x + rect->width > backing->total_width)
+				rect->width = backing->total_width - rect->x;
+			if (rect->y + rect->height > backing->total_height)
+				rect->height = backing->total_height - rect->y;
+
+			if (pixels)
+				*pixels += rect->width * rect->height;
+		}
+	}
+
+	return count;
+}
+
+/* Copy 'src' to 'dst' only inside the rectangles, with a single XCopyArea */
+static void backing_copy_rects(backing_t *backing, Drawable src, Drawable dst, int count) {
+	int i;
+	int x1 = backing->total_width, y1 = backing->total_height, x2 = 0, y2 = 0;
+
+	for (i = 0; i < count; i++) {
+		XRectangle *rect = &backing->rects[i];
+		if (rect->x < x1)
+			x1 = rect->x;
+		if (rect->y < y1)
+			y1 = rect->y;
+		if (rect->x + rect->width > x2)
+			x2 = rect->x + rect->width;
+		if (rect->y + rect->height > y2)
+			y2 = rect->y + rect->height;
+	}
+
+	XSetClipRectangles(backing->dpy, backing->gc, 0, 0, backing->rects, count, YXBanded);
+	XCopyArea(backing->dpy, src, dst, backing->gc, x1, y1, x2 - x1, y2 - y1, x1, y1);
+	XSetClipMask(backing->dpy, backing->gc, None);
+}
+
+/* Mark the tiles under the rectangle to be saved. The screen is copied
+ by backing_flush, before anything is drawn there.
+ */
+int backing_save(backing_t *backing, int x, int y, int width, int height) {
+
+	int tx, ty;
 
 	if (backing->active == 0) {
-		backing_reconfigure(backing, backing->total_width, backing->total_height, backing->depth);
 		backing->active = 1;
+		backing->bytes_copied = 0;
+		backing->tiles_saved = 0;
 
-		backing->x = BACKING_INC * (x / BACKING_INC);
-		backing->y = BACKING_INC * (y / BACKING_INC);
-		backing->width = BACKING_INC;
-		backing->height = BACKING_INC;
-		XCopyArea(backing->dpy, backing->root, backing->root_pixmap, backing->gc, backing->x,
-				backing->y, backing->width, backing->height, backing->x, backing->y);
-	} else {
-		if (x >= backing->x + backing->width) {
-			int new_max_x, width_inc;
-			new_max_x = BACKING_INC * ((x / BACKING_INC) + 1);
-			width_inc = new_max_x - (backing->x + backing->width);
-			XCopyArea(backing->dpy, backing->root, backing->root_pixmap, backing->gc,
-					backing->x + backing->width, backing->y, width_inc, backing->height,
-					backing->x + backing->width, backing->y);
-			backing->width += width_inc;
-		}
-		if (x < backing->x) {
-			int new_x, width_inc;
-			new_x = BACKING_INC * (x / BACKING_INC);
-			width_inc = backing->x - new_x;
-			XCopyArea(backing->dpy, backing->root, backing->root_pixmap, backing->gc, new_x,
-					backing->y, width_inc, backing->height, new_x, backing->y);
-			backing->width += width_inc;
-			backing->x = new_x;
-		}
-		if (y >= backing->y + backing->height) {
-			int new_max_y, height_inc;
-			new_max_y = BACKING_INC * ((y / BACKING_INC) + 1);
-			height_inc = new_max_y - (backing->y + backing->height);
-			XCopyArea(backing->dpy, backing->root, backing->root_pixmap, backing->gc, backing->x,
-					backing->y + backing->height, backing->width, height_inc, backing->x,
-					backing->y + backing->height);
-			backing->height += height_inc;
-		}
-		if (y < backing->y) {
-			int new_y, height_inc;
-			new_y = BACKING_INC * (y / BACKING_INC);
-			height_inc = backing->y - new_y;
-			XCopyArea(backing->dpy, backing->root, backing->root_pixmap, backing->gc, backing->x,
-					new_y, backing->width, height_inc, backing->x, new_y);
-			backing->height += height_inc;
-			backing->y = new_y;
+		/* mapping the window clears it to its transparent background */
+		if (backing->overlay)
+			XMapRaised(backing->dpy, backing->overlay);
+	}
+
+	if (backing->overlay)
+		return 0;
+
+	if (x < 0) {
+		width += x;
+		x = 0;
+	}
+	if (y < 0) {
+		height += y;
+		y = 0;
+	}
+	if (x + width > backing->total_width)
+		width = backing->total_width - x;
+	if (y + height > backing->total_height)
+		height = backing->total_height - y;
+
+	if (width <= 0 || height <= 0)
+		return 0;
+
+	int min_tx = x / BACKING_TILE;
+	int min_ty = y / BACKING_TILE;
+	int max_tx = (x + width - 1) / BACKING_TILE;
+	int max_ty = (y + height - 1) / BACKING_TILE;
+
+	for (ty = min_ty; ty <= max_ty; ty++) {
+		for (tx = min_tx; tx <= max_tx; tx++) {
+			int i = ty * backing->tiles_x + tx;
+			if (!TILE_TEST(backing->saved, i)) {
+				TILE_SET(backing->saved, i);
+				TILE_SET(backing->pending, i);
+				backing->saved_count++;
+				backing->pending_count++;
+			}
 		}
 	}
+
+	if (min_tx < backing->min_tx)
+		backing->min_tx = min_tx;
+	if (min_ty < backing->min_ty)
+		backing->min_ty = min_ty;
+	if (max_tx > backing->max_tx)
+		backing->max_tx = max_tx;
+	if (max_ty > backing->max_ty)
+		backing->max_ty = max_ty;
+
 	return 0;
 }
 
+/* Copy the tiles marked by backing_save from the screen */
+void backing_flush(backing_t *backing) {
+
+	if (backing->pending_count == 0)
+		return;
+
+	unsigned long pixels = 0;
+	int count = backing_tile_rects(backing, backing->pending, 0, 0, backing->tiles_x - 1,
+			backing->tiles_y - 1, &pixels);
+
+	backing_copy_rects(backing, backing->root, backing->root_pixmap, count);
+
+	backing->bytes_copied += pixels * 4;
+
+	memset(backing->pending, 0, sizeof(unsigned long) * TILE_WORDS(backing));
+	backing->pending_count = 0;
+}
+
+/* Limit the drawing on the root window to the saved tiles inside the
+ area. Anything else in root_pixmap is not the current screen. Returns 0 if
+ no tile is saved there.
+ */
+int backing_clip(backing_t *backing, int x, int y, int width, int height) {
+
+	int count = backing_tile_rects(backing, backing->saved, x / BACKING_TILE, y / BACKING_TILE,
+			(x + width - 1) / BACKING_TILE, (y + height - 1) / BACKING_TILE, NULL);
+
+	if (count) {
+		XSetClipRectangles(backing->dpy, backing->gc, 0, 0, backing->rects, count, YXBanded);
+		XRenderSetPictureClipRectangles(backing->dpy, backing->root_pict, 0, 0, backing->rects,
+				count);
+	}
+
+	return count;
+}
+
+void backing_unclip(backing_t *backing) {
+
+	XRenderPictureAttributes attr;
+
+	XSetClipMask(backing->dpy, backing->gc, None);
+
+	attr.clip_mask = None;
+	XRenderChangePicture(backing->dpy, backing->root_pict, CPClipMask, &attr);
+}
+
+/* Put the saved tiles back on the screen. The pixmaps are kept for the
+ next gesture, only the tiles that were drawn on are cleared.
+ */
 int backing_restore(backing_t *backing) {
 
+	XRenderColor color;
+
+	if (backing->active != 0 && backing->overlay) {
+		if (backing->raster)
+			raster_clear(backing->raster);
+		XUnmapWindow(backing->dpy, backing->overlay);
+		XDeleteProperty(backing->dpy, backing->overlay, backing->opacity_atom);
+		backing->active = 0;
+	}
+
 	if (backing->active != 0) {
 
-		XCopyArea(backing->dpy, backing->root_pixmap, backing->root, backing->gc, backing->x,
-				backing->y, backing->width, backing->height, backing->x, backing->y);
+		/* never drawn, nothing to put back */
+		memset(backing->pending, 0, sizeof(unsigned long) * TILE_WORDS(backing));
+		backing->pending_count = 0;
 
-		backing->active = 0;
+		unsigned long pixels = 0;
+		int count = backing_tile_rects(backing, backing->saved, 0, 0, backing->tiles_x - 1,
+				backing->tiles_y - 1, &pixels);
 
-		XFreePixmap(backing->dpy, backing->root_pixmap);
-		backing->root_pixmap = 0;
-		XRenderFreePicture(backing->dpy, backing->root_pict);
-		backing->root_pict = 0;
+		if (count) {
+			backing_copy_rects(backing, backing->root_pixmap, backing->root, count);
 
-		XFreePixmap(backing->dpy, backing->brush_pixmap);
-		backing->brush_pixmap = 0;
-		XRenderFreePicture(backing->dpy, backing->brush_pict);
-		backing->brush_pict = 0;
+			color.red = 0;
+			color.green = 0;
+			color.blue = 0;
+			color.alpha = 0;
+			XRenderFillRectangles(backing->dpy, PictOpSrc, backing->brush_pict, &color,
+					backing->rects, count);
+		}
 
+		backing->bytes_copied += pixels * 4;
+		backing->tiles_saved = backing->saved_count;
+
+		backing_clear_tiles(backing);
+
+		backing->active = 0;
 	}
 
 	return 0;
 }
 
+/* Show what was drawn on the overlay with the given opacity, between 0
+ and 1, until backing_restore. The root window is not faded: the saved
+ tiles would be copied over whatever the actions changed under the trail.
+ */
+void backing_fade(backing_t *backing, double opacity) {
+
+	if (backing->active == 0 || !backing->overlay)
+		return;
+
+	if (opacity < 0)
+		opacity = 0;
+	if (opacity > 1)
+		opacity = 1;
+
+	/* the compositing manager fades the whole window */
+	unsigned long value = (unsigned long) (opacity * 0xffffffffUL);
+	XChangeProperty(backing->dpy, backing->overlay, backing->opacity_atom, XA_CARDINAL, 32,
+			PropModeReplace, (unsigned char *) &value, 1);
+}
+
+/* (Re)create the pixmaps for a screen of the given size. Called by
+ backing_init and when the screen changes. Whatever was saved is kept.
+ */
 int backing_reconfigure(backing_t *backing, int width, int height, int depth) {
 
 	XRenderColor color;
 	XRenderPictureAttributes attr;
 	backing_t old_backing = *backing;
 
+	if (backing->overlay) {
+		backing->total_width = width;
+		backing->total_height = height;
+		XResizeWindow(backing->dpy, backing->overlay, width, height);
+		/* without an image, draw on the overlay with XRender */
+		if (backing->raster
+				&& raster_resize(backing->raster, backing->overlay_visual, width, height)) {
+			raster_deinit(backing->raster);
+			free(backing->raster);
+			backing->raster = NULL;
+		}
+		return 0;
+	}
+
 	backing->total_width = width;
 	backing->total_height = height;
 	backing->depth = depth;
@@ -198,11 +534,36 @@ int backing_reconfigure(backing_t *backing, int width, int height, int depth) {
 	XRenderFillRectangle(backing->dpy,
 	PictOpSrc, backing->brush_pict, &color, 0, 0, backing->total_width, backing->total_height);
 
+	/* the tiles that were saved on the old screen stay saved if they still exist */
+	backing->tiles_x = (width + BACKING_TILE - 1) / BACKING_TILE;
+	backing->tiles_y = (height + BACKING_TILE - 1) / BACKING_TILE;
+	backing->saved = calloc(TILE_WORDS(backing), sizeof(unsigned long));
+	backing->pending = calloc(TILE_WORDS(backing), sizeof(unsigned long));
+	backing_clear_tiles(backing);
+
+	if (old_backing.saved) {
+		int tx, ty;
+		for (ty = 0; ty < old_backing.tiles_y && ty < backing->tiles_y; ty++) {
+			for (tx = 0; tx < old_backing.tiles_x && tx < backing->tiles_x; tx++) {
+				if (TILE_TEST(old_backing.saved, ty * old_backing.tiles_x + tx)) {
+					backing_save(backing, tx * BACKING_TILE, ty * BACKING_TILE, 1, 1);
+				}
+			}
+		}
+		memset(backing->pending, 0, sizeof(unsigned long) * TILE_WORDS(backing));
+		backing->pending_count = 0;
+		backing->active = old_backing.active;
+		backing->bytes_copied = old_backing.bytes_copied;
+		backing->tiles_saved = old_backing.tiles_saved;
+
+		free(old_backing.saved);
+		free(old_backing.pending);
+	}
+
 	if (old_backing.root_pixmap) {
 		if (old_backing.depth == depth) {
-			XCopyArea(backing->dpy, old_backing.root_pixmap, backing->root_pixmap, backing->gc,
-					old_backing.x, old_backing.y, old_backing.width, old_backing.height,
-					old_backing.x, old_backing.y);
+			XCopyArea(backing->dpy, old_backing.root_pixmap, backing->root_pixmap, backing->gc, 0,
+					0, old_backing.total_width, old_backing.total_height, 0, 0);
 		}
 		XFreePixmap(old_backing.dpy, old_backing.root_pixmap);
 		old_backing.root_pixmap = 0;
@@ -221,4 +582,3 @@ int backing_reconfigure(backing_t *backing, int width, int height, int depth) {
 
 	return 0;
 }
-
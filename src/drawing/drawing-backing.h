@@ -19,7 +19,10 @@
 #include <X11/Xlib.h>
 #include <X11/extensions/Xrender.h>
 
-#define BACKING_INC 100
+#include "drawing-raster.h"
+
+/* the screen is saved and restored in tiles of BACKING_TILE x BACKING_TILE pixels */
+#define BACKING_TILE 64
 
 struct backing {
 	Display *dpy;
@@ -37,15 +40,47 @@ struct backing {
 
 	int active;
 
-	int x, y;
-	int width, height;
+	/* with a compositing manager the brush draws on a transparent window
+	 instead, and nothing needs to be saved. None otherwise */
+	Window overlay;
+	Colormap overlay_colormap;
+	Visual *overlay_visual;
+	Atom opacity_atom;
+
+	/* the overlay drawn on the client, see backing_init_raster. NULL if
+	 the X server draws it */
+	raster_t *raster;
+
+	/* one bit per tile. 'saved' tiles hold the screen contents in root_pixmap,
+	 'pending' tiles are copied from the screen by the next backing_flush */
+	int tiles_x, tiles_y;
+	unsigned long *saved;
+	unsigned long *pending;
+	int saved_count;
+	int pending_count;
+
+	/* tiles that may be set, in tile coordinates */
+	int min_tx, min_ty, max_tx, max_ty;
+
+	XRectangle *rects;
+	int rects_size;
+
+	/* statistics of the current gesture */
+	unsigned long bytes_copied;
+	int tiles_saved;
 };
 typedef struct backing backing_t;
 
 int backing_init(backing_t *backing, Display *dpy, Window root, int width, int height, int depth);
+int backing_init_overlay(backing_t *backing, Display *dpy, Window root, int width, int height);
+int backing_init_raster(backing_t *backing);
 void backing_deinit(backing_t *backing);
-int backing_save(backing_t *backing, int x, int y);
+int backing_save(backing_t *backing, int x, int y, int width, int height);
+void backing_flush(backing_t *backing);
+int backing_clip(backing_t *backing, int x, int y, int width, int height);
+void backing_unclip(backing_t *backing);
 int backing_restore(backing_t *backing);
+void backing_fade(backing_t *backing, double opacity);
 int backing_reconfigure(backing_t *backing, int width, int height, int depth);
 
 #endif
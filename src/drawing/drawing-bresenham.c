@@ -88,3 +88,69 @@ void bresenham_skip_first_last(bresenham_cb_t cb, void *data, int x1, int y1, in
 		}
 	}
 }
+
+/* Like bresenham_skip_first, but calls back only every 'spacing' pixels.
+ 'step' is the number of pixels walked since the last call back, so a
+ line made of many segments keeps the same spacing. Returns the 'step'
+ for the next segment.
+ */
+int bresenham_spaced(bresenham_cb_t cb, void *data, int x1, int y1, int x2, int y2, int spacing,
+		int step) {
+	int dy = y2 - y1;
+	int dx = x2 - x1;
+	int stepx, stepy;
+
+	if (dy < 0) {
+		dy = -dy;
+		stepy = -1;
+	} else {
+		stepy = 1;
+	}
+	if (dx < 0) {
+		dx = -dx;
+		stepx = -1;
+	} else {
+		stepx = 1;
+	}
+
+	if (dx == 0 && dy == 0)
+		return step;
+
+	dy <<= 1;
+	dx <<= 1;
+	if (dx > dy) {
+		int fraction = dy - (dx >> 1);
+		while (1) {
+			if (fraction >= 0) {
+				y1 += stepy;
+				fraction -= dx;
+			}
+			x1 += stepx;
+			fraction += dy;
+			if (++step >= spacing) {
+				(cb)(data, x1, y1);
+				step = 0;
+			}
+			if (x1 == x2)
+				break;
+		}
+	} else {
+		int fraction = dx - (dy >> 1);
+		while (1) {
+			if (fraction >= 0) {
+				x1 += stepx;
+				fraction -= dy;
+			}
+			y1 += stepy;
+			fraction += dx;
+			if (++step >= spacing) {
+				(cb)(data, x1, y1);
+				step = 0;
+			}
+			if (y1 == y2)
+				break;
+		}
+	}
+
+	return step;
+}
@@ -22,5 +22,7 @@ void bresenham(bresenham_cb_t cb, void *data, int x1, int y1, int x2, int y2);
 void bresenham_skip_first(bresenham_cb_t cb, void *data, int x1, int y1, int x2, int y2);
 void bresenham_skip_last(bresenham_cb_t cb, void *data, int x1, int y1, int x2, int y2);
 void bresenham_skip_first_last(bresenham_cb_t cb, void *data, int x1, int y1, int x2, int y2);
+int bresenham_spaced(bresenham_cb_t cb, void *data, int x1, int y1, int x2, int y2, int spacing,
+		int step);
 
 #endif
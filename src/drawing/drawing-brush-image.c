@@ -1,60 +1,162 @@
-/* GIMP RGBA C-Source image dump (brush-image.h) */
+/* brush-image.c - generate the images of the brush and its shadow
+
+ Copyright 2016 Lucas Augusto Deters
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2, or (at your option)
+ any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <math.h>
 
 #include "drawing-brush-image.h"
 
-struct brush_image_t brush_image_blue = { 7, 7, 4,
-		"\0\0\377\0\0\0\377\0\0\0\377\0\0\0\377\0\0\0\377\0\0\0\0\0\0\0\0\0\0\0\377"
-				"\0\0\0\3776\0\0\377i\0\0\3776\0\0\377\0\0\0\0\0\0\0\0\0\0\0\377\0\0\0\377"
-				"i\0\0\377\177\0\0\377i\0\0\377\0\0\0\0\0\0\0\0\0\0\0\377\0\0\0\3776\0\0\377"
-				"i\0\0\3776\0\0\377\0\0\0\0\0\0\0\0\0\0\0\377\0\0\0\377\0\0\0\377\0\0\0\377"
-				"\0\0\0\377\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0"
-				"\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0", };
-
-struct brush_image_t brush_image_red = { 7, 7, 4,
-		"\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\377\0\0"
-				"\12\377\0\0\17\377\0\0\17\377\0\0\17\377\0\0\17\0\0\0\0\0\0\0\0\377\0\0\17"
-				"\377\0\0\224\377\0\0\224\377\0\0\224\377\0\0\24\0\0\0\0\0\0\0\0\377\0\0\17"
-				"\377\0\0\224\377\0\0\224\377\0\0\224\377\0\0\17\0\0\0\0\0\0\0\0\377\0\0\17"
-				"\377\0\0\224\377\0\0\224\377\0\0\224\377\0\0\17\0\0\0\0\0\0\0\0\377\0\0\17"
-				"\377\0\0\17\377\0\0\17\377\0\0\17\377\0\0\17\0\0\0\0\0\0\0\0\0\0\0\0\0\0"
-				"\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0", };
-
-struct brush_image_t brush_image_green = { 7, 7, 4,
-		"\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\377\0"
-				"\12\0\377\0\17\0\377\0\17\0\377\0\17\0\377\0\17\0\0\0\0\0\0\0\0\0\377\0\17"
-				"\0\377\0\224\0\377\0\224\0\377\0\224\0\377\0\24\0\0\0\0\0\0\0\0\0\377\0\17"
-				"\0\377\0\224\0\377\0\224\0\377\0\224\0\377\0\17\0\0\0\0\0\0\0\0\0\377\0\17"
-				"\0\377\0\224\0\377\0\224\0\377\0\224\0\377\0\17\0\0\0\0\0\0\0\0\0\377\0\17"
-				"\0\377\0\17\0\377\0\17\0\377\0\17\0\377\0\17\0\0\0\0\0\0\0\0\0\0\0\0\0\0"
-				"\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0", };
-
-struct brush_image_t brush_image_yellow = { 7, 7, 4,
-		"\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\374\377"
-				"\0\12\374\377\0\17\374\377\0\17\374\377\0\17\374\377\0\17\0\0\0\0\0\0\0\0"
-				"\374\377\0\17\374\377\0\224\374\377\0\224\374\377\0\224\374\377\0\24\0\0"
-				"\0\0\0\0\0\0\374\377\0\17\374\377\0\224\374\377\0\224\374\377\0\224\374\377"
-				"\0\17\0\0\0\0\0\0\0\0\374\377\0\17\374\377\0\224\374\377\0\224\374\377\0"
-				"\224\374\377\0\17\0\0\0\0\0\0\0\0\374\377\0\17\374\377\0\17\374\377\0\17"
-				"\374\377\0\17\374\377\0\17\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0"
-				"\0\0\0\0\0\0\0\0\0", };
-
-struct brush_image_t brush_image_white = { 7, 7, 4,
-		"\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\377\377"
-				"\377\12\377\377\377\17\377\377\377\17\377\377\377\17\377\377\377\17\0\0\0"
-				"\0\0\0\0\0\377\377\377\17\377\377\377\224\377\377\377\224\377\377\377\224"
-				"\377\377\377\24\0\0\0\0\0\0\0\0\377\377\377\17\377\377\377\224\377\377\377"
-				"\224\377\377\377\224\377\377\377\17\0\0\0\0\0\0\0\0\377\377\377\17\377\377"
-				"\377\224\377\377\377\224\377\377\377\224\377\377\377\17\0\0\0\0\0\0\0\0\377"
-				"\377\377\17\377\377\377\17\377\377\377\17\377\377\377\17\377\377\377\17\0"
-				"\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0", };
-
-struct brush_image_t brush_image_purple = { 7, 7, 4,
-		"\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\234\0\377"
-				"\12\234\0\377\17\234\0\377\17\234\0\377\17\234\0\377\17\0\0\0\0\0\0\0\0\234"
-				"\0\377\17\234\0\377\224\234\0\377\224\234\0\377\224\234\0\377\24\0\0\0\0"
-				"\0\0\0\0\234\0\377\17\234\0\377\224\234\0\377\224\234\0\377\224\234\0\377"
-				"\17\0\0\0\0\0\0\0\0\234\0\377\17\234\0\377\224\234\0\377\224\234\0\377\224"
-				"\234\0\377\17\0\0\0\0\0\0\0\0\234\0\377\17\234\0\377\17\234\0\377\17\234"
-				"\0\377\17\234\0\377\17\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0"
-				"\0\0\0\0\0\0\0", };
+#ifdef DMALLOC
+#include "dmalloc.h"
+#endif
+
+/* the shadow is a darker disc, a pixel wider than the brush on each side,
+ fading towards its border */
+#define SHADOW_OPACITY 0x7f
+#define SHADOW_FALLOFF 0.5
+
+static const struct {
+	const char *name;
+	unsigned char rgb[3];
+} named_colors[] = {
+	{ "blue", { 0x00, 0x00, 0xff } },
+	{ "red", { 0xff, 0x00, 0x00 } },
+	{ "green", { 0x00, 0xff, 0x00 } },
+	{ "yellow", { 0xfc, 0xff, 0x00 } },
+	{ "white", { 0xff, 0xff, 0xff } },
+	{ "purple", { 0x9c, 0x00, 0xff } },
+};
+
+#define NAMED_COLORS_COUNT (sizeof(named_colors) / sizeof(named_colors[0]))
+
+/* a * b / 255, rounded. Thanks to Keith Packard. */
+#define FbIntMult(a,b,t) ( (t) = (a) * (b) + 0x80, ( ( ( (t)>>8 ) + (t) )>>8 ) )
+
+/* Accepts the names above, #rrggbb and #rrggbbaa. Returns 1 if the color
+ can't be read.
+ */
+int brush_image_parse_color(const char *name, unsigned char rgba[4]) {
+
+	int i;
+	unsigned int value;
+	int length;
+
+	for (i = 0; i < NAMED_COLORS_COUNT; i++) {
+		if (strcasecmp(name, named_colors[i].name) == 0) {
+			memcpy(rgba, named_colors[i].rgb, 3);
+			rgba[3] = BRUSH_IMAGE_OPACITY;
+			return 0;
+		}
+	}
+
+	if (name[0] != '#')
+		return 1;
+
+	length = strlen(name + 1);
+	if (length != 6 && length != 8)
+		return 1;
+	if (strspn(name + 1, "0123456789abcdefABCDEF") != length)
+		return 1;
+
+	value = strtoul(name + 1, NULL, 16);
+	if (length == 6)
+		value = (value << 8) | BRUSH_IMAGE_OPACITY;
+
+	rgba[0] = value >> 24;
+	rgba[1] = value >> 16;
+	rgba[2] = value >> 8;
+	rgba[3] = value;
+
+	return 0;
+}
+
+/* A disc of the given color and radius, centered in a square image. The
+ border is antialiased, and with a falloff the alpha drops towards the
+ border as 1 - falloff * (d / radius)^2.
+ */
+static struct brush_image_t *brush_image_generate(int size, const unsigned char rgba[4],
+		double radius, double falloff) {
+
+	struct brush_image_t *image = malloc(sizeof(struct brush_image_t));
+	uint32_t *pixels = malloc((size_t) size * size * 4);
+	double center = size / 2.0;
+	int x, y;
+
+	image->width = size;
+	image->height = size;
+	image->pixel_data = (unsigned char *) pixels;
+
+	for (y = 0; y < size; y++) {
+		for (x = 0; x < size; x++) {
+			double dx = x + 0.5 - center;
+			double dy = y + 0.5 - center;
+			double d = sqrt(dx * dx + dy * dy);
+
+			double coverage = radius + 0.5 - d;
+			if (coverage < 0)
+				coverage = 0;
+			if (coverage > 1)
+				coverage = 1;
+
+			double fade = 1 - falloff * (d / radius) * (d / radius);
+			if (fade < 0)
+				fade = 0;
+
+			unsigned int a = (unsigned int) (rgba[3] * coverage * fade + 0.5);
+			unsigned int t;
+			unsigned int r = FbIntMult(rgba[0], a, t);
+			unsigned int g = FbIntMult(rgba[1], a, t);
+			unsigned int b = FbIntMult(rgba[2], a, t);
+
+			pixels[y * size + x] = (a << 24) | (r << 16) | (g << 8) | b;
+		}
+	}
+
+	return image;
+}
+
+/* A brush 'width' pixels wide, with a transparent pixel around it for the
+ shadow.
+ */
+struct brush_image_t *brush_image_new(const unsigned char rgba[4], double width) {
+
+	if (width < 1)
+		width = 1;
+	if (width > BRUSH_IMAGE_MAX_WIDTH)
+		width = BRUSH_IMAGE_MAX_WIDTH;
+
+	int size = (int) ceil(width) + 2;
+
+	return brush_image_generate(size, rgba, width / 2.0, 0);
+}
+
+/* The shadow of a brush, in an image of the same size */
+struct brush_image_t *brush_image_new_shadow(const struct brush_image_t *image) {
+
+	const unsigned char black[4] = { 0, 0, 0, SHADOW_OPACITY };
+
+	return brush_image_generate(image->width, black, image->width / 2.0, SHADOW_FALLOFF);
+}
 
+void brush_image_free(struct brush_image_t *image) {
+	if (!image)
+		return;
+	free(image->pixel_data);
+	free(image);
+}
@@ -1,19 +1,24 @@
 #ifndef BRUSH_IMAGE
 #define BRUSH_IMAGE
 
+/* default brush width, in pixels at 96 dpi */
+#define BRUSH_IMAGE_WIDTH 5
+
+/* widest brush, after scaling. Keeps the images and pixmaps small */
+#define BRUSH_IMAGE_MAX_WIDTH 256
+
+/* opacity of the named colors and of #rrggbb */
+#define BRUSH_IMAGE_OPACITY 0x94
+
 struct brush_image_t {
 	unsigned int width;
 	unsigned int height;
-	unsigned int bytes_per_pixel; /* 3:RGB, 4:RGBA */
-	unsigned char pixel_data[7 * 7 * 4 + 1];
+	unsigned char *pixel_data; /* premultiplied ARGB32, in the byte order of this machine */
 };
 
-extern struct brush_image_t *brush_image;
-extern struct brush_image_t brush_image_blue;
-extern struct brush_image_t brush_image_red;
-extern struct brush_image_t brush_image_purple;
-extern struct brush_image_t brush_image_green;
-extern struct brush_image_t brush_image_white;
-extern struct brush_image_t brush_image_yellow;
+int brush_image_parse_color(const char *name, unsigned char rgba[4]);
+struct brush_image_t *brush_image_new(const unsigned char rgba[4], double width);
+struct brush_image_t *brush_image_new_shadow(const struct brush_image_t *image);
+void brush_image_free(struct brush_image_t *image);
 
 #endif
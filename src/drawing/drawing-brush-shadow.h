@@ -1,15 +0,0 @@
-/* GIMP RGBA C-Source image dump (brush-shadow.h) */
-
-static const struct {
-	unsigned int width;
-	unsigned int height;
-	unsigned int bytes_per_pixel; /* 3:RGB, 4:RGBA */
-	unsigned char pixel_data[7 * 7 * 4 + 1];
-} brush_shadow = { 7, 7, 4,
-		"\0\0\0\0\0\0\0\22\0\0\0" "2\0\0\0E\0\0\0" "2\0\0\0\22\0\0\0\0\0\0\0\22\0\0"
-				"\0V\0\0\0t\0\0\0y\0\0\0t\0\0\0V\0\0\0\22\0\0\0" "2\0\0\0t\0\0\0~\0\0\0\177"
-				"\0\0\0~\0\0\0t\0\0\0" "2\0\0\0E\0\0\0y\0\0\0\177\0\0\0\177\0\0\0\177\0\0\0"
-				"y\0\0\0E\0\0\0" "2\0\0\0t\0\0\0~\0\0\0\177\0\0\0~\0\0\0t\0\0\0" "2\0\0\0\22"
-				"\0\0\0V\0\0\0t\0\0\0y\0\0\0t\0\0\0V\0\0\0\22\0\0\0\0\0\0\0\22\0\0\0" "2\0"
-				"\0\0E\0\0\0" "2\0\0\0\22\0\0\0\0", };
-
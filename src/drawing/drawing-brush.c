@@ -22,29 +22,35 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <stdint.h>
 #include <X11/Xlib.h>
 #include <X11/extensions/Xrender.h>
 
 #include "drawing-bresenham.h"
 #include "drawing-brush.h"
-#define const
 #include "drawing-brush-image.h"
-#include "drawing-brush-shadow.h"
-#undef const
 
 #ifdef DMALLOC
 #include "dmalloc.h"
 #endif
 
-static void fix_image(unsigned char *image, int npixels);
+/* the brush is stamped every width / BRUSH_SPACING_DIVISOR pixels */
+#define BRUSH_SPACING_DIVISOR 2
 
-int brush_init(brush_t *brush, backing_t *backing, struct brush_image_t *bi) {
+static Picture create_fill(Display *dpy, const unsigned char *pixel);
+static void put_image(Display *dpy, Drawable drawable, GC gc, struct brush_image_t *bi);
+
+/* The images are premultiplied already, see brush_image_new. They must live
+ as long as the brush.
+ */
+int brush_init(brush_t *brush, backing_t *backing, struct brush_image_t *bi,
+		struct brush_image_t *shadow) {
 	Display *dpy = backing->dpy;
 	Window root = backing->root;
-	int screen = DefaultScreen(backing->dpy);
 	XRenderPictFormat templ;
 
-	XImage *image;
 	XRenderPictFormat *image_format;
 	GC image_gc;
 
@@ -55,13 +61,36 @@ int brush_init(brush_t *brush, backing_t *backing, struct brush_image_t *bi) {
 	brush->image_height = bi->height;
 	brush->image_pict = 0;
 
-	brush->shadow_width = brush_shadow.width;
-	brush->shadow_height = brush_shadow.height;
+	brush->shadow_width = shadow->width;
+	brush->shadow_height = shadow->height;
 	brush->shadow_pict = 0;
 
+	brush->image_data = bi->pixel_data;
+	brush->shadow_data = shadow->pixel_data;
+
 	brush->last_x = 0;
 	brush->last_y = 0;
 
+	brush->path = NULL;
+	brush->path_count = 0;
+	brush->path_size = 0;
+
+	brush->stamps = NULL;
+	brush->stamp_count = 0;
+	brush->stamp_size = 0;
+	brush->spacing = bi->width / BRUSH_SPACING_DIVISOR;
+	/* stamping is cheap on the client, so the trail is all stamps */
+	if (brush->spacing < 1 || backing->raster)
+		brush->spacing = 1;
+	brush->step = 0;
+
+	/* the trail between stamps is filled with the colors at the center of the images */
+	brush->stroke_fill = create_fill(dpy,
+			bi->pixel_data + ((bi->height / 2) * bi->width + bi->width / 2) * 4);
+	brush->shadow_fill = create_fill(dpy,
+			shadow->pixel_data + ((shadow->height / 2) * shadow->width + shadow->width / 2) * 4);
+	brush->mask_format = XRenderFindStandardFormat(dpy, PictStandardA8);
+
 	brush->image_pixmap = XCreatePixmap(dpy, root, brush->image_width, brush->image_height, 32);
 
 	brush->shadow_pixmap = XCreatePixmap(dpy, root, brush->shadow_width, brush->shadow_height, 32);
@@ -97,18 +126,8 @@ int brush_init(brush_t *brush, backing_t *backing, struct brush_image_t *bi) {
 
 	image_gc = XCreateGC(dpy, brush->image_pixmap, 0, 0);
 
-	fix_image(bi->pixel_data, bi->width * bi->height);
-	image = XCreateImage(dpy, DefaultVisual(dpy, screen), 32, ZPixmap, 0, (char *) bi->pixel_data,
-			brush->image_width, brush->image_height, 32, brush->image_width * 4);
-	XPutImage(dpy, brush->image_pixmap, image_gc, image, 0, 0, 0, 0, brush->image_width,
-			brush->image_height);
-
-	fix_image(brush_shadow.pixel_data, brush_shadow.width * brush_shadow.height);
-	image = XCreateImage(dpy, DefaultVisual(dpy, screen), 32, ZPixmap, 0,
-			(char *) brush_shadow.pixel_data, brush->shadow_width, brush->shadow_height, 32,
-			brush->shadow_width * 4);
-	XPutImage(dpy, brush->shadow_pixmap, image_gc, image, 0, 0, 0, 0, brush->shadow_width,
-			brush->shadow_height);
+	put_image(dpy, brush->image_pixmap, image_gc, bi);
+	put_image(dpy, brush->shadow_pixmap, image_gc, shadow);
 
 	XFreeGC(dpy, image_gc);
 
@@ -120,9 +139,28 @@ void brush_deinit(brush_t *brush) {
 	XFreePixmap(brush->dpy, brush->shadow_pixmap);
 	XRenderFreePicture(brush->dpy, brush->image_pict);
 	XRenderFreePicture(brush->dpy, brush->shadow_pict);
+	XRenderFreePicture(brush->dpy, brush->stroke_fill);
+	XRenderFreePicture(brush->dpy, brush->shadow_fill);
+	free(brush->path);
+	brush->path = NULL;
+	brush->path_count = 0;
+	brush->path_size = 0;
+	free(brush->stamps);
+	brush->stamps = NULL;
+	brush->stamp_count = 0;
+	brush->stamp_size = 0;
 }
 
-void brush_draw(brush_t *brush, int x, int y) {
+/* draw the brush on the brush pixmap, without showing it */
+static void brush_stamp(brush_t *brush, int x, int y) {
+	if (brush->backing->raster) {
+		raster_over_reverse(brush->backing->raster, brush->shadow_data, brush->shadow_width,
+				brush->shadow_height, x, y);
+		raster_over(brush->backing->raster, brush->image_data, brush->image_width,
+				brush->image_height, x, y);
+		return;
+	}
+
 	XRenderComposite(brush->dpy,
 	PictOpConjointOverReverse, brush->shadow_pict, None, brush->backing->brush_pict, 0, 0, 0, 0, x,
 			y, brush->shadow_width, brush->shadow_height);
@@ -130,47 +168,230 @@ void brush_draw(brush_t *brush, int x, int y) {
 	XRenderComposite(brush->dpy,
 	PictOpConjointOver, brush->image_pict, None, brush->backing->brush_pict, 0, 0, 0, 0, x, y,
 			brush->image_width, brush->image_height);
+}
 
-	XCopyArea(brush->dpy, brush->backing->root_pixmap, DefaultRootWindow(brush->dpy),
-			brush->backing->gc, x, y, brush->image_width, brush->image_height, x, y);
+/* show the brush pixmap over the saved screen contents */
+static void brush_show(brush_t *brush, int x, int y, int width, int height) {
+	if (brush->backing->raster) {
+		brush->backing->bytes_copied += raster_put(brush->backing->raster);
+		return;
+	}
 
-	XRenderComposite(brush->dpy,
-	PictOpOver, brush->backing->brush_pict, None, brush->backing->root_pict, x, y, 0, 0, x, y,
-			brush->image_width, brush->image_height);
+	/* the overlay window shows what is drawn on it */
+	if (brush->backing->overlay)
+		return;
 
-	brush->last_x = x;
-	brush->last_y = y;
+	if (backing_clip(brush->backing, x, y, width, height)) {
+		XCopyArea(brush->dpy, brush->backing->root_pixmap, DefaultRootWindow(brush->dpy),
+				brush->backing->gc, x, y, width, height, x, y);
+
+		XRenderComposite(brush->dpy,
+		PictOpOver, brush->backing->brush_pict, None, brush->backing->root_pict, x, y, 0, 0, x,
+				y, width, height);
+
+		backing_unclip(brush->backing);
+	}
 }
 
-void brush_line_to(brush_t *brush, int x, int y) {
-	bresenham_skip_first((bresenham_cb_t) brush_draw, brush, brush->last_x, brush->last_y, x, y);
+/* the screen under a stamp must be saved before it is drawn */
+static void brush_save(brush_t *brush, int x, int y) {
+	int width = brush->image_width > brush->shadow_width ? brush->image_width : brush->shadow_width;
+	int height =
+			brush->image_height > brush->shadow_height ? brush->image_height : brush->shadow_height;
+
+	backing_save(brush->backing, x - 1, y - 1, width + 2, height + 2);
+}
+
+void brush_draw(brush_t *brush, int x, int y) {
+	brush_save(brush, x, y);
+	backing_flush(brush->backing);
+
+	brush_stamp(brush, x, y);
+	brush_show(brush, x, y, brush->image_width, brush->image_height);
+
+	brush->path_count = 0;
+	brush->stamp_count = 0;
+	brush->step = 0;
 	brush->last_x = x;
 	brush->last_y = y;
 }
 
-/* Fix byte order as it comes from the GIMP, and pre-multiply
- alpha.
- Thanks to Keith Packard.
+/* forget the trail that wasn't flushed yet */
+void brush_clear(brush_t *brush) {
+	brush->path_count = 0;
+	brush->stamp_count = 0;
+	brush->step = 0;
+}
+
+static void point_append(XPoint **list, int *count, int *size, int x, int y) {
+	if (*count == *size) {
+		*size = *size ? *size * 2 : 64;
+		*list = realloc(*list, sizeof(XPoint) * *size);
+	}
+
+	(*list)[*count].x = x;
+	(*list)[*count].y = y;
+	(*count)++;
+}
+
+static void brush_add_stamp(brush_t *brush, int x, int y) {
+	brush_save(brush, x, y);
+	point_append(&brush->stamps, &brush->stamp_count, &brush->stamp_size, x, y);
+}
+
+/*
+ * Add a point to the trail. Nothing is drawn until brush_flush.
  */
-static void fix_image(unsigned char *image, int npixels) {
-#define FbIntMult(a,b,t) ( (t) = (a) * (b) + 0x80, ( ( ( (t)>>8 ) + (t) )>>8 ) )
+void brush_line_to(brush_t *brush, int x, int y) {
+	int from_x = brush->last_x;
+	int from_y = brush->last_y;
+
+	if (brush->path_count) {
+		from_x = brush->path[brush->path_count - 1].x;
+		from_y = brush->path[brush->path_count - 1].y;
+	}
+
+	brush->step = bresenham_spaced((bresenham_cb_t) brush_add_stamp, brush, from_x, from_y, x, y,
+			brush->spacing, brush->step);
+
+	brush_save(brush, x, y);
+	point_append(&brush->path, &brush->path_count, &brush->path_size, x, y);
+}
+
+/* the two triangles of a segment 'half_width' away from the line between the points */
+static void segment_triangles(XTriangle *triangles, double x1, double y1, double x2, double y2,
+		double half_width) {
+	double dx = x2 - x1;
+	double dy = y2 - y1;
+	double length = sqrt(dx * dx + dy * dy);
+
+	double nx = -dy / length * half_width;
+	double ny = dx / length * half_width;
+
+	triangles[0].p1.x = XDoubleToFixed(x1 + nx);
+	triangles[0].p1.y = XDoubleToFixed(y1 + ny);
+	triangles[0].p2.x = XDoubleToFixed(x1 - nx);
+	triangles[0].p2.y = XDoubleToFixed(y1 - ny);
+	triangles[0].p3.x = XDoubleToFixed(x2 - nx);
+	triangles[0].p3.y = XDoubleToFixed(y2 - ny);
+
+	triangles[1].p1 = triangles[0].p1;
+	triangles[1].p2 = triangles[0].p3;
+	triangles[1].p3.x = XDoubleToFixed(x2 + nx);
+	triangles[1].p3.y = XDoubleToFixed(y2 + ny);
+}
 
+/*
+ * Draw the trail added since the last flush as one batch of triangles for
+ * the shadow, one for the stroke and the spaced stamps, then show the
+ * area that changed. The cost depends on the frames, not on the length of
+ * the trail. Returns 0 if there was nothing to draw.
+ */
+int brush_flush(brush_t *brush) {
 	int i;
-	for (i = 0; i < npixels; i++) {
-		unsigned char a, r, g, b;
-		unsigned short t;
-
-		b = image[i * 4 + 0];
-		g = image[i * 4 + 1];
-		r = image[i * 4 + 2];
-		a = image[i * 4 + 3];
-
-		r = FbIntMult(a, r, t);
-		g = FbIntMult(a, g, t);
-		b = FbIntMult(a, b, t);
-		image[i * 4 + 0] = r;
-		image[i * 4 + 1] = g;
-		image[i * 4 + 2] = b;
-		image[i * 4 + 3] = a;
+	int count = 0;
+
+	if (brush->path_count == 0)
+		return 0;
+
+	backing_flush(brush->backing);
+
+	XTriangle *strokes = malloc(sizeof(XTriangle) * 4 * brush->path_count);
+	XTriangle *shadows = strokes + 2 * brush->path_count;
+
+	double center_x = brush->image_width / 2.0;
+	double center_y = brush->image_height / 2.0;
+
+	int x = brush->last_x;
+	int y = brush->last_y;
+
+	int min_x = x, min_y = y, max_x = x, max_y = y;
+
+	for (i = 0; i < brush->path_count; i++) {
+		int next_x = brush->path[i].x;
+		int next_y = brush->path[i].y;
+
+		if (next_x == x && next_y == y)
+			continue;
+
+		segment_triangles(strokes + count, x + center_x, y + center_y, next_x + center_x,
+				next_y + center_y, (brush->image_width - 2) / 2.0);
+		segment_triangles(shadows + count, x + center_x, y + center_y, next_x + center_x,
+				next_y + center_y, brush->shadow_width / 2.0);
+		count += 2;
+
+		x = next_x;
+		y = next_y;
+
+		if (x < min_x)
+			min_x = x;
+		if (y < min_y)
+			min_y = y;
+		if (x > max_x)
+			max_x = x;
+		if (y > max_y)
+			max_y = y;
+	}
+
+	if (count && !brush->backing->raster) {
+		XRenderCompositeTriangles(brush->dpy, PictOpConjointOverReverse, brush->shadow_fill,
+				brush->backing->brush_pict, brush->mask_format, 0, 0, shadows, count);
+		XRenderCompositeTriangles(brush->dpy, PictOpConjointOver, brush->stroke_fill,
+				brush->backing->brush_pict, brush->mask_format, 0, 0, strokes, count);
+	}
+
+	for (i = 0; i < brush->stamp_count; i++) {
+		brush_stamp(brush, brush->stamps[i].x, brush->stamps[i].y);
 	}
+
+	/* round the head of the trail */
+	if (brush->step)
+		brush_stamp(brush, x, y);
+
+	int width = brush->image_width > brush->shadow_width ? brush->image_width : brush->shadow_width;
+	int height =
+			brush->image_height > brush->shadow_height ? brush->image_height : brush->shadow_height;
+
+	brush_show(brush, min_x, min_y, max_x - min_x + width, max_y - min_y + height);
+
+	free(strokes);
+
+	brush->path_count = 0;
+	brush->stamp_count = 0;
+	brush->last_x = x;
+	brush->last_y = y;
+
+	return 1;
+}
+
+/* a solid fill with the color of a premultiplied pixel */
+static Picture create_fill(Display *dpy, const unsigned char *pixel) {
+	XRenderColor color;
+	uint32_t argb = *(const uint32_t *) pixel;
+
+	color.alpha = (argb >> 24) * 257;
+	color.red = ((argb >> 16) & 0xff) * 257;
+	color.green = ((argb >> 8) & 0xff) * 257;
+	color.blue = (argb & 0xff) * 257;
+
+	return XRenderCreateSolidFill(dpy, &color);
+}
+
+static void put_image(Display *dpy, Drawable drawable, GC gc, struct brush_image_t *bi) {
+	union {
+		uint32_t word;
+		unsigned char bytes[4];
+	} order = { 1 };
+
+	XImage *image = XCreateImage(dpy, DefaultVisual(dpy, DefaultScreen(dpy)), 32, ZPixmap, 0,
+			(char *) bi->pixel_data, bi->width, bi->height, 32, bi->width * 4);
+
+	/* the pixels are in our byte order, Xlib swaps them if the server differs */
+	image->byte_order = order.bytes[0] ? LSBFirst : MSBFirst;
+
+	XPutImage(dpy, drawable, gc, image, 0, 0, 0, 0, bi->width, bi->height);
+
+	/* the pixels belong to the caller */
+	image->data = NULL;
+	XDestroyImage(image);
 }
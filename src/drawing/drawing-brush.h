@@ -35,15 +35,38 @@ struct brush {
 	Pixmap shadow_pixmap;
 	Picture shadow_pict;
 
+	/* premultiplied ARGB32, for backing->raster */
+	const unsigned char *image_data;
+	const unsigned char *shadow_data;
+
 	int last_x;
 	int last_y;
+
+	/* the trail waiting for the next frame, see brush_flush */
+	XPoint *path;
+	int path_count;
+	int path_size;
+
+	/* where the brush is stamped along the trail, every 'spacing' pixels */
+	XPoint *stamps;
+	int stamp_count;
+	int stamp_size;
+	int spacing;
+	int step;
+
+	Picture stroke_fill;
+	Picture shadow_fill;
+	XRenderPictFormat *mask_format;
 };
 typedef struct brush brush_t;
 
-int brush_init(brush_t *brush, backing_t *backing, struct brush_image_t *brush_image);
+int brush_init(brush_t *brush, backing_t *backing, struct brush_image_t *brush_image,
+		struct brush_image_t *brush_shadow);
 void brush_deinit(brush_t *brush);
 
 void brush_draw(brush_t *brush, int x, int y);
 void brush_line_to(brush_t *brush, int x, int y);
+int brush_flush(brush_t *brush);
+void brush_clear(brush_t *brush);
 
 #endif
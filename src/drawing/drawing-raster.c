@@ -0,0 +1,380 @@
+/* raster.c - draw the brush on the client and send the changed rows
+
+ Copyright 2016 Lucas Augusto Deters
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2, or (at your option)
+ any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include <X11/Xlib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "drawing-raster.h"
+
+#ifdef DMALLOC
+#include "dmalloc.h"
+#endif
+
+/* a * b / 255, rounded. Thanks to Keith Packard. */
+#define FbIntMult(a,b,t) ( (t) = (a) * (b) + 0x80, ( ( ( (t)>>8 ) + (t) )>>8 ) )
+
+static int attach_failed;
+
+static int on_attach_error(Display *dpy, XErrorEvent *error) {
+	attach_failed = 1;
+	return 0;
+}
+
+/* Shared memory only works if the server runs on this machine. Find out
+ by trying.
+ */
+static int raster_attach_shm(raster_t *raster, Visual *visual) {
+
+	int major, minor;
+	Bool pixmaps;
+
+	if (!XShmQueryVersion(raster->dpy, &major, &minor, &pixmaps))
+		return 0;
+
+	raster->image = XShmCreateImage(raster->dpy, visual, 32, ZPixmap, NULL, &raster->shminfo,
+			raster->width, raster->height);
+	if (!raster->image)
+		return 0;
+
+	raster->shminfo.shmid = shmget(IPC_PRIVATE, raster->image->bytes_per_line * raster->height,
+			IPC_CREAT | 0600);
+	if (raster->shminfo.shmid < 0) {
+		XDestroyImage(raster->image);
+		raster->image = NULL;
+		return 0;
+	}
+
+	raster->shminfo.shmaddr = shmat(raster->shminfo.shmid, NULL, 0);
+	if (raster->shminfo.shmaddr == (char *) -1) {
+		shmctl(raster->shminfo.shmid, IPC_RMID, NULL);
+		XDestroyImage(raster->image);
+		raster->image = NULL;
+		return 0;
+	}
+
+	raster->image->data = raster->shminfo.shmaddr;
+	raster->shminfo.readOnly = False;
+
+	XSync(raster->dpy, False);
+	attach_failed = 0;
+	int (*old_handler)(Display *, XErrorEvent *) = XSetErrorHandler(on_attach_error);
+
+	XShmAttach(raster->dpy, &raster->shminfo);
+	XSync(raster->dpy, False);
+
+	XSetErrorHandler(old_handler);
+
+	raster->completion_type = XShmGetEventBase(raster->dpy) + ShmCompletion;
+
+	/* gone as soon as both sides detach */
+	shmctl(raster->shminfo.shmid, IPC_RMID, NULL);
+
+	if (attach_failed) {
+		shmdt(raster->shminfo.shmaddr);
+		raster->image->data = NULL;
+		XDestroyImage(raster->image);
+		raster->image = NULL;
+		return 0;
+	}
+
+	return 1;
+}
+
+static int raster_create_image(raster_t *raster, Visual *visual) {
+
+	raster->shm = raster_attach_shm(raster, visual);
+
+	if (!raster->shm) {
+		char *data = malloc(raster->width * raster->height * 4);
+		if (!data)
+			return 1;
+		raster->image = XCreateImage(raster->dpy, visual, 32, ZPixmap, 0, data, raster->width,
+				raster->height, 32, raster->width * 4);
+		if (!raster->image) {
+			free(data);
+			return 1;
+		}
+	}
+
+	memset(raster->image->data, 0, raster->image->bytes_per_line * raster->height);
+
+	raster->dirty_x1 = raster->drawn_x1 = raster->width;
+	raster->dirty_y1 = raster->drawn_y1 = raster->height;
+	raster->dirty_x2 = raster->drawn_x2 = 0;
+	raster->dirty_y2 = raster->drawn_y2 = 0;
+
+	return 0;
+}
+
+static Bool is_completion(Display *dpy, XEvent *event, XPointer arg) {
+	raster_t *raster = (raster_t *) arg;
+
+	return event->type == raster->completion_type
+			&& ((XShmCompletionEvent *) event)->drawable == raster->target;
+}
+
+/* Don't write to the segment before the server is done reading it. The
+ event loop may have seen the completion already, see raster_handle_event.
+ */
+static void raster_wait(raster_t *raster) {
+
+	XEvent event;
+
+	if (!raster->put_pending)
+		return;
+
+	XIfEvent(raster->dpy, &event, is_completion, (XPointer) raster);
+	raster->put_pending = 0;
+}
+
+/* Returns 1 if the event is the completion of our last put */
+int raster_handle_event(raster_t *raster, XEvent *event) {
+
+	if (!raster->shm || !is_completion(raster->dpy, event, (XPointer) raster))
+		return 0;
+
+	raster->put_pending = 0;
+	return 1;
+}
+
+static void raster_destroy_image(raster_t *raster) {
+
+	if (!raster->image)
+		return;
+
+	raster_wait(raster);
+
+	if (raster->shm) {
+		XShmDetach(raster->dpy, &raster->shminfo);
+		shmdt(raster->shminfo.shmaddr);
+		raster->image->data = NULL;
+	}
+
+	XDestroyImage(raster->image);
+	raster->image = NULL;
+}
+
+int raster_init(raster_t *raster, Display *dpy, Window target, Visual *visual, int width, int height) {
+
+	raster->dpy = dpy;
+	raster->target = target;
+	raster->gc = XCreateGC(dpy, target, 0, 0);
+	raster->width = width;
+	raster->height = height;
+	raster->image = NULL;
+	raster->put_pending = 0;
+
+	return raster_create_image(raster, visual);
+}
+
+void raster_deinit(raster_t *raster) {
+	raster_destroy_image(raster);
+	XFreeGC(raster->dpy, raster->gc);
+}
+
+int raster_resize(raster_t *raster, Visual *visual, int width, int height) {
+	raster_destroy_image(raster);
+	raster->width = width;
+	raster->height = height;
+	return raster_create_image(raster, visual);
+}
+
+/* out = top OVER bottom, for premultiplied ARGB32 pixels */
+static void blend_row(uint32_t *out, const uint32_t *top, const uint32_t *bottom, int n) {
+	int i = 0;
+
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i alpha_max = _mm_set1_epi16(0xff);
+	const __m128i half = _mm_set1_epi16(0x80);
+
+	for (; i + 4 <= n; i += 4) {
+		__m128i t = _mm_loadu_si128((const __m128i *) (top + i));
+		__m128i b = _mm_loadu_si128((const __m128i *) (bottom + i));
+
+		/* two pixels per register, 16 bits per channel */
+		__m128i b_lo = _mm_unpacklo_epi8(b, zero);
+		__m128i b_hi = _mm_unpackhi_epi8(b, zero);
+		__m128i t_lo = _mm_unpacklo_epi8(t, zero);
+		__m128i t_hi = _mm_unpackhi_epi8(t, zero);
+
+		/* 255 - alpha of the top pixel, on every channel */
+		__m128i a_lo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(t_lo, 0xff), 0xff);
+		__m128i a_hi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(t_hi, 0xff), 0xff);
+		a_lo = _mm_sub_epi16(alpha_max, a_lo);
+		a_hi = _mm_sub_epi16(alpha_max, a_hi);
+
+		__m128i m_lo = _mm_add_epi16(_mm_mullo_epi16(b_lo, a_lo), half);
+		__m128i m_hi = _mm_add_epi16(_mm_mullo_epi16(b_hi, a_hi), half);
+		m_lo = _mm_srli_epi16(_mm_add_epi16(m_lo, _mm_srli_epi16(m_lo, 8)), 8);
+		m_hi = _mm_srli_epi16(_mm_add_epi16(m_hi, _mm_srli_epi16(m_hi, 8)), 8);
+
+		__m128i result = _mm_adds_epu8(t, _mm_packus_epi16(m_lo, m_hi));
+		_mm_storeu_si128((__m128i *) (out + i), result);
+	}
+#endif
+
+	for (; i < n; i++) {
+		uint32_t t = top[i];
+		uint32_t b = bottom[i];
+		unsigned int inverse = 255 - (t >> 24);
+		uint32_t result = 0;
+		int shift;
+
+		for (shift = 0; shift < 32; shift += 8) {
+			unsigned int tmp;
+			unsigned int channel = ((t >> shift) & 0xff)
+					+ FbIntMult((b >> shift) & 0xff, inverse, tmp);
+			if (channel > 255)
+				channel = 255;
+			result |= channel << shift;
+		}
+
+		out[i] = result;
+	}
+}
+
+static void raster_mark(raster_t *raster, int x1, int y1, int x2, int y2) {
+	if (x1 < raster->dirty_x1)
+		raster->dirty_x1 = x1;
+	if (y1 < raster->dirty_y1)
+		raster->dirty_y1 = y1;
+	if (x2 > raster->dirty_x2)
+		raster->dirty_x2 = x2;
+	if (y2 > raster->dirty_y2)
+		raster->dirty_y2 = y2;
+
+	if (x1 < raster->drawn_x1)
+		raster->drawn_x1 = x1;
+	if (y1 < raster->drawn_y1)
+		raster->drawn_y1 = y1;
+	if (x2 > raster->drawn_x2)
+		raster->drawn_x2 = x2;
+	if (y2 > raster->drawn_y2)
+		raster->drawn_y2 = y2;
+}
+
+static void raster_blend(raster_t *raster, const unsigned char *pixels, int width, int height,
+		int x, int y, int reverse) {
+
+	int stride = width;
+	int src_x = 0, src_y = 0;
+	int row;
+
+	if (x < 0) {
+		src_x = -x;
+		width += x;
+		x = 0;
+	}
+	if (y < 0) {
+		src_y = -y;
+		height += y;
+		y = 0;
+	}
+	if (x + width > raster->width)
+		width = raster->width - x;
+	if (y + height > raster->height)
+		height = raster->height - y;
+
+	if (width <= 0 || height <= 0)
+		return;
+
+	raster_wait(raster);
+
+	const uint32_t *src = (const uint32_t *) pixels;
+
+	for (row = 0; row < height; row++) {
+		uint32_t *dst = (uint32_t *) (raster->image->data
+				+ (y + row) * raster->image->bytes_per_line) + x;
+		const uint32_t *line = src + (src_y + row) * stride + src_x;
+
+		if (reverse)
+			blend_row(dst, dst, line, width);
+		else
+			blend_row(dst, line, dst, width);
+	}
+
+	raster_mark(raster, x, y, x + width, y + height);
+}
+
+/* draw the pixels over the image */
+void raster_over(raster_t *raster, const unsigned char *pixels, int width, int height, int x, int y) {
+	raster_blend(raster, pixels, width, height, x, y, 0);
+}
+
+/* draw the pixels under the image */
+void raster_over_reverse(raster_t *raster, const unsigned char *pixels, int width, int height,
+		int x, int y) {
+	raster_blend(raster, pixels, width, height, x, y, 1);
+}
+
+/* send the rows that changed since the last call. Returns the bytes sent */
+unsigned long raster_put(raster_t *raster) {
+
+	if (raster->dirty_x2 <= raster->dirty_x1 || raster->dirty_y2 <= raster->dirty_y1)
+		return 0;
+
+	int x = raster->dirty_x1;
+	int y = raster->dirty_y1;
+	int width = raster->dirty_x2 - x;
+	int height = raster->dirty_y2 - y;
+
+	/* the server reads the segment after the request is sent. The next
+	 raster_clear or blend waits for the completion event */
+	if (raster->shm) {
+		XShmPutImage(raster->dpy, raster->target, raster->gc, raster->image, x, y, x, y, width,
+				height, True);
+		raster->put_pending = 1;
+	} else
+		XPutImage(raster->dpy, raster->target, raster->gc, raster->image, x, y, x, y, width,
+				height);
+
+	raster->dirty_x1 = raster->width;
+	raster->dirty_y1 = raster->height;
+	raster->dirty_x2 = 0;
+	raster->dirty_y2 = 0;
+
+	return (unsigned long) width * height * 4;
+}
+
+/* make everything that was drawn transparent again, on the client only */
+void raster_clear(raster_t *raster) {
+
+	int row;
+
+	raster_wait(raster);
+
+	if (raster->drawn_x2 > raster->drawn_x1) {
+		for (row = raster->drawn_y1; row < raster->drawn_y2; row++) {
+			memset(raster->image->data + row * raster->image->bytes_per_line + raster->drawn_x1 * 4,
+					0, (raster->drawn_x2 - raster->drawn_x1) * 4);
+		}
+	}
+
+	raster->dirty_x1 = raster->drawn_x1 = raster->width;
+	raster->dirty_y1 = raster->drawn_y1 = raster->height;
+	raster->dirty_x2 = raster->drawn_x2 = 0;
+	raster->dirty_y2 = raster->drawn_y2 = 0;
+}
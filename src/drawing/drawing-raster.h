@@ -0,0 +1,62 @@
+/* raster.h - draw the brush on the client and send the changed rows
+
+ Copyright 2016 Lucas Augusto Deters
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2, or (at your option)
+ any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ */
+
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+
+/* An ARGB image of a window, drawn on the client side. The changed rows
+ are sent with XShmPutImage, or XPutImage if the server can't share memory
+ with us.
+ */
+struct raster {
+	Display *dpy;
+	Drawable target;
+	GC gc;
+
+	XImage *image;
+	XShmSegmentInfo shminfo;
+	int shm;
+
+	/* the server may still read the segment until this ShmCompletion */
+	int completion_type;
+	int put_pending;
+
+	int width, height;
+
+	/* changed since the last raster_put, x2 and y2 excluded */
+	int dirty_x1, dirty_y1, dirty_x2, dirty_y2;
+
+	/* drawn since the last raster_clear */
+	int drawn_x1, drawn_y1, drawn_x2, drawn_y2;
+};
+typedef struct raster raster_t;
+
+int raster_init(raster_t *raster, Display *dpy, Window target, Visual *visual, int width, int height);
+void raster_deinit(raster_t *raster);
+int raster_resize(raster_t *raster, Visual *visual, int width, int height);
+
+void raster_over(raster_t *raster, const unsigned char *pixels, int width, int height, int x, int y);
+void raster_over_reverse(raster_t *raster, const unsigned char *pixels, int width, int height,
+		int x, int y);
+
+unsigned long raster_put(raster_t *raster);
+void raster_clear(raster_t *raster);
+int raster_handle_event(raster_t *raster, XEvent *event);
+
+#endif
@@ -0,0 +1,245 @@
+/*
+ Copyright 2016 Lucas Augusto Deters
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2, or (at your option)
+ any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ one line to give the program's name and an idea of what it does.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+
+#include "eventloop.h"
+
+#define EVENTLOOP_MAX_EVENTS 16
+
+EventLoop * eventloop_new() {
+
+	EventLoop * self = malloc(sizeof(EventLoop));
+	memset(self, 0, sizeof(EventLoop));
+
+	self->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (self->epoll_fd < 0) {
+		perror("In epoll_create1()");
+		free(self);
+		return NULL;
+	}
+
+	return self;
+}
+
+static void eventloop_free_watch(EventLoopWatch * watch) {
+	if (watch->owned && watch->fd >= 0) {
+		close(watch->fd);
+	}
+	free(watch);
+}
+
+void eventloop_free(EventLoop * self) {
+
+	if (!self) {
+		return;
+	}
+
+	for (int i = 0; i < self->watch_count; ++i) {
+		eventloop_free_watch(self->watches[i]);
+	}
+
+	free(self->watches);
+	close(self->epoll_fd);
+	free(self);
+}
+
+static int eventloop_add_watch(EventLoop * self, int fd, int owned, EventLoopCallback callback,
+		void * data) {
+
+	EventLoopWatch * watch = malloc(sizeof(EventLoopWatch));
+	watch->fd = fd;
+	watch->owned = owned;
+	watch->callback = callback;
+	watch->data = data;
+
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.ptr = watch;
+
+	if (epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+		perror("In epoll_ctl()");
+		free(watch);
+		return -1;
+	}
+
+	if (self->watch_count == self->watch_size) {
+		self->watch_size = self->watch_size ? self->watch_size * 2 : 8;
+		self->watches = realloc(self->watches, sizeof(EventLoopWatch *) * self->watch_size);
+	}
+
+	self->watches[self->watch_count++] = watch;
+
+	return fd;
+}
+
+/*
+ * Call 'callback' whenever 'fd' can be read. The fd still belongs to the
+ * caller. Returns -1 on error.
+ */
+int eventloop_add(EventLoop * self, int fd, EventLoopCallback callback, void * data) {
+	return eventloop_add_watch(self, fd, 0, callback, data);
+}
+
+void eventloop_remove(EventLoop * self, int fd) {
+
+	for (int i = 0; i < self->watch_count; ++i) {
+
+		EventLoopWatch * watch = self->watches[i];
+
+		if (watch->fd != fd || !watch->callback) {
+			continue;
+		}
+
+		epoll_ctl(self->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+
+		if (self->dispatching) {
+			/* the current epoll_wait may still return it */
+			watch->callback = NULL;
+			return;
+		}
+
+		self->watches[i] = self->watches[--self->watch_count];
+		eventloop_free_watch(watch);
+		return;
+	}
+}
+
+/*
+ * A timer, stopped until eventloop_set_timer. The callback reads the
+ * number of expirations from the fd. Returns the fd, or -1.
+ */
+int eventloop_add_timer(EventLoop * self, EventLoopCallback callback, void * data) {
+
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+	if (fd < 0) {
+		perror("In timerfd_create()");
+		return -1;
+	}
+
+	if (eventloop_add_watch(self, fd, 1, callback, data) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/*
+ * Expire in 'first_ns', then every 'interval_ns' if not 0. A 'first_ns' of
+ * 0 stops the timer.
+ */
+void eventloop_set_timer(int fd, long first_ns, long interval_ns) {
+
+	struct itimerspec timer;
+	memset(&timer, 0, sizeof(timer));
+
+	timer.it_value.tv_sec = first_ns / 1000000000L;
+	timer.it_value.tv_nsec = first_ns % 1000000000L;
+	timer.it_interval.tv_sec = interval_ns / 1000000000L;
+	timer.it_interval.tv_nsec = interval_ns % 1000000000L;
+
+	timerfd_settime(fd, 0, &timer, NULL);
+}
+
+/*
+ * Receive the signals through the loop instead of a handler. They are
+ * blocked in this process, so children forked after this call must
+ * unblock them. The callback reads a struct signalfd_siginfo from the fd.
+ */
+int eventloop_add_signals(EventLoop * self, const int * signals, int count,
+		EventLoopCallback callback, void * data) {
+
+	sigset_t mask;
+	sigemptyset(&mask);
+
+	for (int i = 0; i < count; ++i) {
+		sigaddset(&mask, signals[i]);
+	}
+
+	int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+	if (fd < 0) {
+		perror("In signalfd()");
+		return -1;
+	}
+
+	if (eventloop_add_watch(self, fd, 1, callback, data) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	return fd;
+}
+
+/*
+ * Sleep until a watched fd can be read or 'timeout_ms' passes (-1 waits
+ * forever), and call the callbacks of the ready fds. Returns how many were
+ * ready, or -1 on error.
+ */
+int eventloop_wait(EventLoop * self, int timeout_ms) {
+
+	struct epoll_event events[EVENTLOOP_MAX_EVENTS];
+
+	int n = epoll_wait(self->epoll_fd, events, EVENTLOOP_MAX_EVENTS, timeout_ms);
+
+	if (n < 0) {
+		if (errno == EINTR) {
+			return 0;
+		}
+		perror("In epoll_wait()");
+		return -1;
+	}
+
+	self->dispatching = 1;
+
+	for (int i = 0; i < n; ++i) {
+		EventLoopWatch * watch = events[i].data.ptr;
+		if (watch->callback) {
+			watch->callback(watch->fd, watch->data);
+		}
+	}
+
+	self->dispatching = 0;
+
+	/* free what the callbacks removed */
+	for (int i = 0; i < self->watch_count; ++i) {
+		EventLoopWatch * watch = self->watches[i];
+		if (!watch->callback) {
+			self->watches[i--] = self->watches[--self->watch_count];
+			eventloop_free_watch(watch);
+		}
+	}
+
+	return n;
+}
@@ -0,0 +1,61 @@
+/*
+ Copyright 2016 Lucas Augusto Deters
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2, or (at your option)
+ any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ one line to give the program's name and an idea of what it does.
+ */
+
+#ifndef MYGESTURES_EVENTLOOP_H_
+#define MYGESTURES_EVENTLOOP_H_
+
+/*
+ * Called when 'fd' can be read. The callback must read it, or it is called
+ * again on the next wait.
+ */
+typedef void (*EventLoopCallback)(int fd, void * data);
+
+typedef struct eventloop_watch_ {
+	int fd;
+	int owned; /* created by the loop, closed when removed */
+	EventLoopCallback callback;
+	void * data;
+} EventLoopWatch;
+
+/*
+ * Every file descriptor the grabber waits on: the X connection, timers,
+ * signals, devices. They are all waited on in a single epoll_wait.
+ */
+typedef struct eventloop_ {
+	int epoll_fd;
+
+	EventLoopWatch ** watches;
+	int watch_count;
+	int watch_size;
+
+	/* watches removed by a callback are freed after the dispatch */
+	int dispatching;
+} EventLoop;
+
+EventLoop * eventloop_new();
+void eventloop_free(EventLoop * self);
+
+int eventloop_add(EventLoop * self, int fd, EventLoopCallback callback, void * data);
+void eventloop_remove(EventLoop * self, int fd);
+
+int eventloop_add_timer(EventLoop * self, EventLoopCallback callback, void * data);
+void eventloop_set_timer(int fd, long first_ns, long interval_ns);
+int eventloop_add_signals(EventLoop * self, const int * signals, int count,
+		EventLoopCallback callback, void * data);
+
+int eventloop_wait(EventLoop * self, int timeout_ms);
+
+#endif
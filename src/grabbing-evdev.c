@@ -0,0 +1,365 @@
+/*
+ Copyright 2016 Lucas Augusto Deters
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2, or (at your option)
+ any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ one line to give the program's name and an idea of what it does.
+ */
+
+/*
+ * Multitouch gestures read straight from the kernel evdev device of the
+ * touchpad. The loop sleeps in the event loop of the grabber until the
+ * touchpad or the X connection has something to say.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+
+#include <sys/ioctl.h>
+#include <linux/input.h>
+
+#include <X11/Xlib.h>
+
+#include "grabbing-evdev.h"
+
+#define EVDEV_DIR "/dev/input"
+#define EVDEV_FINGERS 3
+
+#define BITS_PER_LONG (sizeof(long) * 8)
+#define NBITS(x) ((((x)-1) / BITS_PER_LONG) + 1)
+#define TEST_BIT(bit, array) ((array[(bit) / BITS_PER_LONG] >> ((bit) % BITS_PER_LONG)) & 1)
+
+/* number of fingers reported by each BTN_TOOL_* key */
+static const struct
+{
+	int code;
+	int fingers;
+} tool_fingers[] = {
+	{BTN_TOOL_FINGER, 1},
+	{BTN_TOOL_DOUBLETAP, 2},
+	{BTN_TOOL_TRIPLETAP, 3},
+	{BTN_TOOL_QUADTAP, 4},
+	{BTN_TOOL_QUINTTAP, 5}};
+
+#define TOOL_FINGERS_COUNT (sizeof(tool_fingers) / sizeof(tool_fingers[0]))
+
+typedef struct
+{
+	Grabber *grabber;
+	GrabberDevice *device;
+	int fd;
+	int gone;
+	int x;
+	int y;
+	int tools;	 /* bit i set while tool_fingers[i] is down */
+	int dropped; /* skipping events until the next SYN_REPORT */
+	int started;
+	int last_x;
+	int last_y;
+} EvdevState;
+
+/*
+ * A touchpad is a pointer device that reports absolute multitouch positions
+ * and how many fingers are down.
+ */
+static int evdev_is_touchpad(int fd)
+{
+	unsigned long abs_bits[NBITS(ABS_CNT)];
+	unsigned long key_bits[NBITS(KEY_CNT)];
+	unsigned long prop_bits[NBITS(INPUT_PROP_CNT)];
+
+	memset(abs_bits, 0, sizeof(abs_bits));
+	memset(key_bits, 0, sizeof(key_bits));
+	memset(prop_bits, 0, sizeof(prop_bits));
+
+	if (ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(abs_bits)), abs_bits) < 0 ||
+		ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(key_bits)), key_bits) < 0)
+	{
+		return 0;
+	}
+
+	/* old kernels don't report properties, so it's not required */
+	ioctl(fd, EVIOCGPROP(sizeof(prop_bits)), prop_bits);
+
+	if (TEST_BIT(INPUT_PROP_DIRECT, prop_bits))
+	{
+		return 0;
+	}
+
+	return TEST_BIT(ABS_X, abs_bits) && TEST_BIT(ABS_Y, abs_bits) &&
+		   TEST_BIT(ABS_MT_POSITION_X, abs_bits) &&
+		   TEST_BIT(BTN_TOOL_TRIPLETAP, key_bits);
+}
+
+static int evdev_open_touchpad()
+{
+	DIR *dir = opendir(EVDEV_DIR);
+	struct dirent *entry;
+	int fd = -1;
+
+	if (!dir)
+	{
+		return -1;
+	}
+
+	while (fd < 0 && (entry = readdir(dir)))
+	{
+		if (strncmp(entry->d_name, "event", 5) != 0)
+		{
+			continue;
+		}
+
+		char path[sizeof(EVDEV_DIR) + sizeof(entry->d_name) + 1];
+		snprintf(path, sizeof(path), "%s/%s", EVDEV_DIR, entry->d_name);
+
+		fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		if (fd < 0)
+		{
+			continue;
+		}
+
+		if (!evdev_is_touchpad(fd))
+		{
+			close(fd);
+			fd = -1;
+			continue;
+		}
+
+		char name[256] = "";
+		ioctl(fd, EVIOCGNAME(sizeof(name)), name);
+
+		printf("\nTouchpad (evdev):\n");
+		printf("   [x] '%s' (%s)\n", name, path);
+	}
+
+	closedir(dir);
+
+	return fd;
+}
+
+/*
+ * Events were lost. Read the current state back from the device.
+ */
+static void evdev_resync(EvdevState *state)
+{
+	unsigned long key_bits[NBITS(KEY_CNT)];
+	struct input_absinfo abs;
+
+	memset(key_bits, 0, sizeof(key_bits));
+
+	if (ioctl(state->fd, EVIOCGKEY(sizeof(key_bits)), key_bits) >= 0)
+	{
+		state->tools = 0;
+		for (int i = 0; i < TOOL_FINGERS_COUNT; ++i)
+		{
+			if (TEST_BIT(tool_fingers[i].code, key_bits))
+			{
+				state->tools |= 1 << i;
+			}
+		}
+	}
+
+	if (ioctl(state->fd, EVIOCGABS(ABS_X), &abs) >= 0)
+	{
+		state->x = abs.value;
+	}
+
+	if (ioctl(state->fd, EVIOCGABS(ABS_Y), &abs) >= 0)
+	{
+		state->y = abs.value;
+	}
+}
+
+static int evdev_fingers(EvdevState *state)
+{
+	int fingers = 0;
+
+	for (int i = 0; i < TOOL_FINGERS_COUNT; ++i)
+	{
+		if (state->tools & (1 << i))
+		{
+			fingers = tool_fingers[i].fingers;
+		}
+	}
+
+	return fingers;
+}
+
+/*
+ * A complete frame was read. Drive the movement with the finger count.
+ */
+static void evdev_sync(Grabber *self, EvdevState *state)
+{
+	int fingers = evdev_fingers(state);
+
+	if (fingers >= EVDEV_FINGERS)
+	{
+		if (!state->started)
+		{
+			if (self->verbose)
+			{
+				printf("started\n");
+			}
+			state->started = 1;
+			grabbing_start_movement(self, state->device, state->x, state->y);
+		}
+		else
+		{
+			grabbing_update_movement(self, state->device, state->x, state->y);
+		}
+
+		state->last_x = state->x;
+		state->last_y = state->y;
+	}
+	else if (fingers == 0 && state->started)
+	{
+		if (self->verbose)
+		{
+			printf("stopped\n");
+		}
+		state->started = 0;
+		grabbing_end_movement(self, state->device, state->last_x, state->last_y,
+							  "Touchpad");
+	}
+}
+
+static void evdev_handle_event(Grabber *self, EvdevState *state,
+							   struct input_event *ev)
+{
+	if (ev->type == EV_SYN)
+	{
+		if (ev->code == SYN_DROPPED)
+		{
+			state->dropped = 1;
+		}
+		else if (ev->code == SYN_REPORT)
+		{
+			if (state->dropped)
+			{
+				evdev_resync(state);
+				state->dropped = 0;
+			}
+			evdev_sync(self, state);
+		}
+		return;
+	}
+
+	if (state->dropped)
+	{
+		return;
+	}
+
+	if (ev->type == EV_ABS)
+	{
+		if (ev->code == ABS_X)
+		{
+			state->x = ev->value;
+		}
+		else if (ev->code == ABS_Y)
+		{
+			state->y = ev->value;
+		}
+	}
+	else if (ev->type == EV_KEY)
+	{
+		for (int i = 0; i < TOOL_FINGERS_COUNT; ++i)
+		{
+			if (ev->code == tool_fingers[i].code)
+			{
+				if (ev->value)
+				{
+					state->tools |= 1 << i;
+				}
+				else
+				{
+					state->tools &= ~(1 << i);
+				}
+			}
+		}
+	}
+}
+
+/*
+ * The touchpad can be read. Everything read at once is drawn once.
+ */
+static void evdev_on_touchpad(int fd, void *data)
+{
+	EvdevState *state = data;
+	struct input_event events[64];
+	ssize_t bytes;
+
+	while ((bytes = read(fd, events, sizeof(events))) > 0)
+	{
+		for (int i = 0; i < bytes / (ssize_t)sizeof(struct input_event); ++i)
+		{
+			evdev_handle_event(state->grabber, state, &events[i]);
+		}
+	}
+
+	if (bytes < 0 && errno != EAGAIN && errno != EINTR)
+	{
+		perror("Touchpad went away");
+		state->gone = 1;
+	}
+
+	/* the trail gets everything that was read at once */
+	grabbing_draw_movement(state->grabber);
+}
+
+/*
+ * Returns -1 if there is no touchpad that can be read, so the caller can try
+ * another backend. Otherwise only returns when the device goes away or the
+ * grabber is shut down.
+ */
+int grabber_evdev_loop(Grabber *self)
+{
+	int fd = evdev_open_touchpad();
+
+	if (fd < 0)
+	{
+		return -1;
+	}
+
+	EvdevState state;
+	memset(&state, 0, sizeof(state));
+	state.grabber = self;
+	state.fd = fd;
+	state.device = &self->device_list[0];
+
+	eventloop_add(self->loop, fd, evdev_on_touchpad, &state);
+
+	while (!self->shut_down && !state.gone)
+	{
+		/* Xlib may have queued events while we were handling the touchpad */
+		while (XPending(self->dpy))
+		{
+			XEvent ev;
+			XNextEvent(self->dpy, &ev);
+			grabber_handle_event(self, &ev);
+		}
+
+		/* the loop is broken, stop like on SIGTERM instead of spinning */
+		if (eventloop_wait(self->loop, -1) < 0)
+		{
+			self->shut_down = 1;
+		}
+	}
+
+	eventloop_remove(self->loop, fd);
+	close(fd);
+
+	return 0;
+}
@@ -0,0 +1,3 @@
+#include "grabbing.h"
+
+int grabber_evdev_loop(Grabber * self);
@@ -208,7 +208,7 @@ void synaptics_disable_3fingers_tap(Grabber *self, XDevice *dev)
 	}
 }
 
-void grabber_synaptics_loop(Grabber *self, Configuration *conf)
+void grabber_synaptics_loop(Grabber *self)
 {
 
 	XDevice *dev = NULL;
@@ -255,21 +255,34 @@ void grabber_synaptics_loop(Grabber *self, Configuration *conf)
 
 	int max_fingers = 0;
 
+	/* multitouch mode grabs the touchpad only */
+	GrabberDevice *device = &self->device_list[0];
+
 	while (!self->shut_down)
 	{
 
+		/* nothing else reads the X connection in this mode */
+		while (XPending(self->dpy))
+		{
+			XEvent ev;
+			XNextEvent(self->dpy, &ev);
+			grabber_handle_event(self, &ev);
+		}
+
 		SynapticsSHM cur = *synshm;
 
 		if (!synaptics_shm_is_equal(&old, &cur))
 		{
 
-			int delay = 10;
+			delay = 10;
 
 			// release
 			if (cur.numFingers >= 3 && max_fingers >= 3)
 			{
 
-				grabbing_update_movement(self, cur.x, cur.y);
+				grabbing_update_movement(self, device, cur.x, cur.y);
+				grabbing_draw_movement(self);
+				grabbing_draw_frame(self);
 
 				//// got > 3 fingers
 			}
@@ -285,10 +298,10 @@ void grabber_synaptics_loop(Grabber *self, Configuration *conf)
 				// reset max fingers
 				max_fingers = 0;
 
-				grabbing_end_movement(self, old.x, old.y, "Synaptics", conf);
+				grabbing_end_movement(self, device, old.x, old.y, "Synaptics");
 
 				/// energy economy
-				int delay = 50;
+				delay = 50;
 			}
 			else if (cur.numFingers >= 3 && max_fingers < 3)
 			{
@@ -309,14 +322,18 @@ void grabber_synaptics_loop(Grabber *self, Configuration *conf)
 						printf("started\n");
 					}
 
-					grabbing_start_movement(self, cur.x, cur.y);
+					grabbing_start_movement(self, device, cur.x, cur.y);
 				}
 			}
 
 			//// movement
 		}
 
-		usleep(delay * 1000);
+		/* the shared memory can't be waited on. poll it, running the timers meanwhile */
+		if (eventloop_wait(self->loop, delay) < 0)
+		{
+			self->shut_down = 1;
+		}
 
 		old = cur;
 	}
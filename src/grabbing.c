@@ -21,23 +21,34 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+#include <stdint.h>
 #include <assert.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/signalfd.h>
+#include <sys/inotify.h>
 
 #include <X11/extensions/XTest.h>	/* emulating device events */
 #include <X11/extensions/XInput2.h> /* capturing device events */
+#include <X11/extensions/Xrandr.h>	/* refresh rate */
 
 #include "drawing/drawing-brush-image.h"
 
 #include "grabbing.h"
+#include "configuration_parser.h"
 #include "grabbing-synaptics.h"
+#include "grabbing-evdev.h"
 #include "actions.h"
+#include "matcher.h"
+#include "launcher.h"
 
 #ifndef MAX_STROKES_PER_CAPTURE
 #define MAX_STROKES_PER_CAPTURE 63 /*TODO*/
 #endif
 
-const char stroke_representations[] = {' ', 'L', 'R', 'U', 'D', '1', '3', '7',
-									   '9'};
+/* used when the server doesn't tell the refresh rate */
+#define DEFAULT_FRAME_RATE 60
 
 static void grabber_open_display(Grabber *self)
 {
@@ -57,31 +68,42 @@ static void grabber_open_display(Grabber *self)
 		printf("XI2 not available. Server supports %d.%d\n", major, minor);
 		exit(-1);
 	}
+
+	actions_init(self->dpy);
 }
 
-static struct brush_image_t *get_brush_image(char *color)
+/*
+ * Scale of the screen from the Xft.dpi resource that desktops set on HiDPI
+ * screens. 1 if it's not set.
+ */
+static double grabber_get_scale(Grabber *self)
 {
+	char *dpi = XGetDefault(self->dpy, "Xft", "dpi");
 
-	struct brush_image_t *brush_image = NULL;
+	if (dpi && atof(dpi) > 0)
+	{
+		return atof(dpi) / 96.0;
+	}
 
-	if (!color)
-		brush_image = NULL;
-	else if (strcasecmp(color, "red") == 0)
-		brush_image = &brush_image_red;
-	else if (strcasecmp(color, "green") == 0)
-		brush_image = &brush_image_green;
-	else if (strcasecmp(color, "yellow") == 0)
-		brush_image = &brush_image_yellow;
-	else if (strcasecmp(color, "white") == 0)
-		brush_image = &brush_image_white;
-	else if (strcasecmp(color, "purple") == 0)
-		brush_image = &brush_image_purple;
-	else if (strcasecmp(color, "blue") == 0)
-		brush_image = &brush_image_blue;
-	else
-		brush_image = NULL;
+	return 1;
+}
 
-	return brush_image;
+/*
+ * The brush and its shadow are generated once, for the color, width and
+ * scale of this grabber.
+ */
+static void grabber_init_brush_image(Grabber *self)
+{
+	double scale = grabber_get_scale(self);
+
+	self->brush_image = brush_image_new(self->brush_color, self->brush_width * scale);
+	self->brush_shadow = brush_image_new_shadow(self->brush_image);
+
+	if (self->verbose)
+	{
+		printf("Brush: %ux%u pixels (scale %.2f)\n", self->brush_image->width,
+			   self->brush_image->height, scale);
+	}
 }
 
 static void grabber_init_drawing(Grabber *self)
@@ -92,21 +114,157 @@ static void grabber_init_drawing(Grabber *self)
 	int err = 0;
 	int scr = DefaultScreen(self->dpy);
 
-	if (self->brush_image)
+	if (self->painting)
 	{
+		grabber_init_brush_image(self);
 
-		err = backing_init(&(self->backing), self->dpy,
-						   DefaultRootWindow(self->dpy), DisplayWidth(self->dpy, scr),
-						   DisplayHeight(self->dpy, scr), DefaultDepth(self->dpy, scr));
+		if (self->overlay)
+		{
+			err = backing_init_overlay(&(self->backing), self->dpy,
+									   DefaultRootWindow(self->dpy), DisplayWidth(self->dpy, scr),
+									   DisplayHeight(self->dpy, scr));
+			if (err)
+			{
+				printf("No compositing manager. Drawing on the root window.\n");
+				self->overlay = 0;
+			}
+			else if (self->raster && backing_init_raster(&(self->backing)))
+			{
+				printf("Cannot draw on the client. Drawing with XRender.\n");
+				self->raster = 0;
+			}
+		}
+
+		if (self->fade_time > 0 && !self->overlay)
+		{
+			printf("Fading needs --overlay. The gesture is erased at once.\n");
+			self->fade_time = 0;
+		}
+
+		if (!self->overlay)
+		{
+			err = backing_init(&(self->backing), self->dpy,
+							   DefaultRootWindow(self->dpy), DisplayWidth(self->dpy, scr),
+							   DisplayHeight(self->dpy, scr), DefaultDepth(self->dpy, scr));
+		}
 		if (err)
 		{
 			fprintf(stderr, "cannot open backing store.... \n");
 		}
-		err = brush_init(&(self->brush), &(self->backing), self->brush_image);
+		err = brush_init(&(self->brush), &(self->backing), self->brush_image,
+						 self->brush_shadow);
 		if (err)
 		{
 			fprintf(stderr, "cannot init brush.... \n");
 		}
+
+		/* the backing store follows the size of the screen */
+		int error_base;
+		if (XRRQueryExtension(self->dpy, &(self->randr_event), &error_base))
+		{
+			XRRSelectInput(self->dpy, DefaultRootWindow(self->dpy),
+						   RRScreenChangeNotifyMask);
+		}
+		else
+		{
+			self->randr_event = -1;
+		}
+	}
+}
+
+/*
+ * Handle the events every grabbing loop is interested in. Returns 1 if the
+ * event was handled.
+ */
+int grabber_handle_event(Grabber *self, XEvent *ev)
+{
+	if (ev->type == MappingNotify)
+	{
+		actions_mapping_notify(&ev->xmapping);
+		return 1;
+	}
+
+	if (self->brush_image && self->randr_event >= 0 && ev->type == self->randr_event + RRScreenChangeNotify)
+	{
+		XRRUpdateConfiguration(ev);
+
+		int scr = DefaultScreen(self->dpy);
+		backing_reconfigure(&(self->backing), DisplayWidth(self->dpy, scr),
+							DisplayHeight(self->dpy, scr), DefaultDepth(self->dpy, scr));
+		return 1;
+	}
+
+	if (self->backing.raster && raster_handle_event(self->backing.raster, ev))
+	{
+		return 1;
+	}
+
+	return 0;
+}
+
+static int grabber_get_frame_rate(Grabber *self)
+{
+	int event_base, error_base;
+	int rate = 0;
+
+	if (XRRQueryExtension(self->dpy, &event_base, &error_base))
+	{
+		XRRScreenConfiguration *info = XRRGetScreenInfo(self->dpy,
+														DefaultRootWindow(self->dpy));
+		if (info)
+		{
+			rate = XRRConfigCurrentRate(info);
+			XRRFreeScreenConfigInfo(info);
+		}
+	}
+
+	if (rate <= 0)
+	{
+		rate = DEFAULT_FRAME_RATE;
+	}
+
+	return rate;
+}
+
+static void grabber_on_frame(int fd, void *data)
+{
+	grabbing_draw_frame((Grabber *)data);
+}
+
+/*
+ * The trail is drawn at most once per frame. Without a timer it is drawn
+ * as soon as the pending events were handled.
+ */
+static void grabber_init_frame_timer(Grabber *self)
+{
+	int rate = grabber_get_frame_rate(self);
+
+	self->frame_interval = 1000000000L / rate;
+	self->frame_fd = eventloop_add_timer(self->loop, grabber_on_frame, self);
+
+	if (self->frame_fd >= 0 && self->verbose)
+	{
+		printf("Drawing at %d frames per second\n", rate);
+	}
+}
+
+/* wait for the editor to finish writing the file */
+#define RELOAD_DELAY_NS 100000000L
+
+static void grabber_set_frame_timer(Grabber *self, int enable)
+{
+	if (self->frame_fd < 0)
+	{
+		return;
+	}
+
+	if (enable)
+	{
+		eventloop_set_timer(self->frame_fd, self->frame_interval, self->frame_interval);
+	}
+	else
+	{
+		eventloop_set_timer(self->frame_fd, 0, 0);
 	}
 }
 
@@ -202,9 +360,14 @@ static Window get_parent_window(Display *dpy, Window w)
 	return parent_return;
 }
 
-void grabbing_xinput_grab_start(Grabber *self)
+void grabbing_xinput_grab_start(Grabber *self, GrabberDevice *device)
 {
 
+	if (device->deviceid < 0)
+	{
+		return;
+	}
+
 	int count = XScreenCount(self->dpy);
 
 	int screen;
@@ -213,12 +376,12 @@ void grabbing_xinput_grab_start(Grabber *self)
 
 		Window rootwindow = RootWindow(self->dpy, screen);
 
-		if (self->is_direct_touch)
+		if (device->is_direct_touch)
 		{
 
-			if (!self->button)
+			if (!device->button)
 			{
-				self->button = 1;
+				device->button = 1;
 			}
 
 			unsigned char mask_data[2] = {
@@ -230,7 +393,7 @@ void grabbing_xinput_grab_start(Grabber *self)
 			XIEventMask mask = {
 				XIAllDevices, sizeof(mask_data), mask_data};
 
-			int status = XIGrabDevice(self->dpy, self->deviceid, rootwindow,
+			int status = XIGrabDevice(self->dpy, device->deviceid, rootwindow,
 									  CurrentTime, None,
 									  GrabModeAsync,
 									  GrabModeAsync, False, &mask);
@@ -238,9 +401,9 @@ void grabbing_xinput_grab_start(Grabber *self)
 		else
 		{
 
-			if (!self->button)
+			if (!device->button)
 			{
-				self->button = 3;
+				device->button = 3;
 			}
 
 			unsigned char mask_data[2] = {
@@ -263,16 +426,21 @@ void grabbing_xinput_grab_start(Grabber *self)
 			nmods = 1;
 			mods[0].modifiers = XIAnyModifier;
 
-			int res = XIGrabButton(self->dpy, self->deviceid, self->button,
+			int res = XIGrabButton(self->dpy, device->deviceid, device->button,
 								   rootwindow, None,
 								   GrabModeAsync, GrabModeAsync, False, &mask, nmods, mods);
 		}
 	}
 }
 
-void grabbing_xinput_grab_stop(Grabber *self)
+void grabbing_xinput_grab_stop(Grabber *self, GrabberDevice *device)
 {
 
+	if (device->deviceid < 0)
+	{
+		return;
+	}
+
 	int count = XScreenCount(self->dpy);
 
 	int screen;
@@ -281,17 +449,17 @@ void grabbing_xinput_grab_stop(Grabber *self)
 
 		Window rootwindow = RootWindow(self->dpy, screen);
 
-		if (self->is_direct_touch)
+		if (device->is_direct_touch)
 		{
 
-			int status = XIUngrabDevice(self->dpy, self->deviceid, CurrentTime);
+			int status = XIUngrabDevice(self->dpy, device->deviceid, CurrentTime);
 		}
 		else
 		{
 			XIGrabModifiers modifiers[4] = {{0, 0}, {0, 0}, {0, 0}, {0, 0}};
 			XIGrabModifiers mods = {
 				XIAnyModifier};
-			XIUngrabButton(self->dpy, self->deviceid, self->button, rootwindow,
+			XIUngrabButton(self->dpy, device->deviceid, device->button, rootwindow,
 						   1, &mods);
 		}
 	}
@@ -303,6 +471,7 @@ static void mouse_click(Display *display, int button, int x, int y)
 	XTestFakeMotionEvent(display, DefaultScreen(display), x, y, 0);
 	XTestFakeButtonEvent(display, button, True, CurrentTime);
 	XTestFakeButtonEvent(display, button, False, CurrentTime);
+	XFlush(display);
 }
 
 static Window get_window_under_pointer(Display *dpy)
@@ -341,9 +510,9 @@ static Window get_focused_window(Display *dpy)
 	return win;
 }
 
-static void execute_action(Display *dpy, Action *action, Window focused_window)
+static void execute_action(Grabber *self, Action *action, Window focused_window)
 {
-	int id;
+	Display *dpy = self->dpy;
 
 	assert(dpy);
 	assert(action);
@@ -352,17 +521,7 @@ static void execute_action(Display *dpy, Action *action, Window focused_window)
 	switch (action->type)
 	{
 	case ACTION_EXECUTE:
-		id = fork();
-		if (id == 0)
-		{
-			int i = system(action->original_str);
-			exit(i);
-		}
-		if (id < 0)
-		{
-			fprintf(stderr, "Error forking.\n");
-		}
-
+		launcher_execute(self->launcher, action->original_str);
 		break;
 	case ACTION_ICONIFY:
 		action_iconify(dpy, focused_window);
@@ -386,20 +545,68 @@ static void execute_action(Display *dpy, Action *action, Window focused_window)
 		action_toggle_maximized(dpy, focused_window);
 		break;
 	case ACTION_KEYPRESS:
-		action_keypress(dpy, action->original_str);
+		action_keypress(dpy, action);
+		break;
+	case ACTION_TOGGLE_FULLSCREEN:
+		action_toggle_fullscreen(dpy, focused_window);
+		break;
+	case ACTION_TOGGLE_STICKY:
+		action_toggle_sticky(dpy, focused_window);
+		break;
+	case ACTION_TOGGLE_ABOVE:
+		action_toggle_above(dpy, focused_window);
+		break;
+	case ACTION_TOGGLE_BELOW:
+		action_toggle_below(dpy, focused_window);
+		break;
+	case ACTION_NEXT_DESKTOP:
+		action_desktop_offset(dpy, 1);
+		break;
+	case ACTION_PREVIOUS_DESKTOP:
+		action_desktop_offset(dpy, -1);
+		break;
+	case ACTION_DESKTOP:
+		action_desktop(dpy, atol(action->original_str));
+		break;
+	case ACTION_RECONF:
+		grabber_reload_configuration(self);
 		break;
 	default:
 		fprintf(stderr, "found an unknown gesture \n");
 	}
 
-	XAllowEvents(dpy, 0, CurrentTime);
-
 	return;
 }
 
+/*
+ * Execute every action of a gesture. The requests are queued by Xlib and
+ * sent to the server in a single flush at the end.
+ */
+static void execute_gesture(Grabber *self, Gesture *gest, Window target_window)
+{
+	unsigned long first_request = NextRequest(self->dpy);
+
+	int j = 0;
+
+	for (j = 0; j < gest->action_count; ++j)
+	{
+		Action *a = &gest->action_list[j];
+		printf("     Executing action: %s %s\n",
+			   get_action_name(a->type), a->original_str);
+		execute_action(self, a, target_window);
+	}
+
+	XAllowEvents(self->dpy, 0, CurrentTime);
+	XFlush(self->dpy);
+
+	printf("     X requests  : %lu\n", NextRequest(self->dpy) - first_request);
+}
+
 static void free_grabbed(Capture *free_me)
 {
 	assert(free_me);
+	free(free_me->expression_list);
+	free(free_me->matcher_state_list);
 	free(free_me->active_window_info);
 	free(free_me);
 }
@@ -503,7 +710,10 @@ static char get_direction_from_deltas(int x_delta, int y_delta)
 	}
 }
 
-static void movement_add_direction(char *stroke_sequence, char direction)
+/*
+ * Returns 1 if the direction was appended to the sequence.
+ */
+static int movement_add_direction(char *stroke_sequence, char direction)
 {
 	// grab stroke
 	int len = strlen(stroke_sequence);
@@ -515,6 +725,48 @@ static void movement_add_direction(char *stroke_sequence, char direction)
 
 			stroke_sequence[len] = direction;
 			stroke_sequence[len + 1] = '\0';
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void grabbing_print_candidates(Configuration *conf, int matcher_state)
+{
+	Matcher *matcher = conf->matcher;
+	const unsigned int *viable = matcher_get_viable(matcher, matcher_state);
+
+	printf("     Candidates  :");
+	for (int i = 0; i < conf->movement_count; ++i)
+	{
+		if (MATCHER_TEST(viable, i))
+		{
+			printf(" %s", conf->movement_list[i].name);
+		}
+	}
+	printf("\n");
+}
+
+/*
+ * Feed a new direction to the matcher, so the sequence is already recognized
+ * when the movement ends.
+ */
+static void grabbing_add_direction(Grabber *self, Configuration *conf,
+								   char *stroke_sequence, int *matcher_state,
+								   char direction)
+{
+	if (!movement_add_direction(stroke_sequence, direction))
+	{
+		return;
+	}
+
+	if (conf && conf->matcher)
+	{
+		*matcher_state = matcher_step(conf->matcher, *matcher_state,
+									  direction);
+		if (self->verbose)
+		{
+			grabbing_print_candidates(conf, *matcher_state);
 		}
 	}
 }
@@ -540,15 +792,52 @@ static int get_touch_status(XIDeviceInfo *device)
 	return 0;
 }
 
+static void grabber_clear_device_info(Grabber *self)
+{
+	for (int i = 0; i < self->device_info_count; ++i)
+	{
+		free(self->device_info_list[i].name);
+	}
+
+	free(self->device_info_list);
+	self->device_info_list = NULL;
+	self->device_info_count = 0;
+}
+
+static DeviceInfo *grabber_get_device_info(Grabber *self, int deviceid)
+{
+	for (int i = 0; i < self->device_info_count; ++i)
+	{
+		if (self->device_info_list[i].deviceid == deviceid)
+		{
+			return &self->device_info_list[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Read every pointer device from the server, and find the ids of the
+ * grabbed devices. This is the only place that queries the devices.
+ */
 static void grabber_xinput_open_devices(Grabber *self, int verbose)
 {
 
 	int ndevices;
-	int i;
+	int i, j;
 	XIDeviceInfo *device;
 	XIDeviceInfo *devices;
-	int deviceid = -1;
+	GrabberDevice *grabbed;
 	devices = XIQueryDevice(self->dpy, XIAllDevices, &ndevices);
+
+	grabber_clear_device_info(self);
+	self->device_info_list = malloc(sizeof(DeviceInfo) * ndevices);
+
+	for (j = 0; j < self->device_count; j++)
+	{
+		self->device_list[j].deviceid = -1;
+	}
+
 	if (verbose)
 	{
 		printf("\nXInput Devices:\n");
@@ -562,23 +851,29 @@ static void grabber_xinput_open_devices(Grabber *self, int verbose)
 		case XIMasterPointer:
 		case XISlavePointer:
 		case XIFloatingSlave:
-			if (strcasecmp(device->name, self->devicename) == 0)
+		{
+			DeviceInfo *info = &self->device_info_list[self->device_info_count++];
+			info->deviceid = device->deviceid;
+			info->use = device->use;
+			info->is_direct_touch = get_touch_status(device);
+			info->name = strdup(device->name);
+
+			grabbed = NULL;
+			for (j = 0; j < self->device_count; j++)
 			{
-				if (verbose)
+				if (strcasecmp(device->name, self->device_list[j].devicename) == 0)
 				{
-					printf("   [x] '%s'\n", device->name);
+					grabbed = &self->device_list[j];
+					grabbed->deviceid = info->deviceid;
+					grabbed->is_direct_touch = info->is_direct_touch;
 				}
-				self->deviceid = device->deviceid;
-				self->is_direct_touch = get_touch_status(device);
 			}
-			else
+			if (verbose)
 			{
-				if (verbose)
-				{
-					printf("   [ ] '%s'\n", device->name);
-				}
+				printf("   [%c] '%s'\n", grabbed ? 'x' : ' ', device->name);
 			}
 			break;
+		}
 		case XIMasterKeyboard:
 			//printf("master keyboard\n");
 			break;
@@ -591,67 +886,207 @@ static void grabber_xinput_open_devices(Grabber *self, int verbose)
 	XIFreeDeviceInfo(devices);
 }
 
+/*
+ * Forget the gesture drawn with 'device'. The trail fades out if 'fade' is
+ * set and fading is possible, otherwise it is erased at once.
+ */
+static void grabber_stop_movement(Grabber *self, GrabberDevice *device,
+								  int fade)
+{
+	device->started = 0;
+	self->active_device = NULL;
+	self->draw_pending = 0;
+
+	if (fade && self->brush_image && self->overlay && self->fade_time > 0 &&
+		self->frame_fd >= 0)
+	{
+		/* the frame timer fades the trail while the actions run */
+		brush_flush(&(self->brush));
+		self->fading = 1;
+		clock_gettime(CLOCK_MONOTONIC, &self->fade_start);
+	}
+	else
+	{
+		grabber_set_frame_timer(self, 0);
+		self->fading = 0;
+		if (self->brush_image)
+		{
+			brush_clear(&(self->brush));
+			backing_restore(&(self->backing));
+		}
+	}
+
+	/* the configuration may have been reloaded while the gesture was drawn */
+	configuration_unref(device->conf);
+	device->conf = NULL;
+}
+
+/*
+ * Devices were added, removed or changed. Read them again and grab the
+ * devices that came back with a new id.
+ */
+static void grabber_xinput_update_devices(Grabber *self)
+{
+	if (self->device_count == 0)
+	{
+		grabber_xinput_open_devices(self, False);
+		return;
+	}
+
+	int old_ids[self->device_count];
+
+	for (int i = 0; i < self->device_count; ++i)
+	{
+		old_ids[i] = self->device_list[i].deviceid;
+	}
+
+	grabber_xinput_open_devices(self, False);
+
+	for (int i = 0; i < self->device_count; ++i)
+	{
+		GrabberDevice *device = &self->device_list[i];
+
+		if (device->deviceid == old_ids[i])
+		{
+			continue;
+		}
+
+		/* a device with the same name is still there and still grabbed */
+		DeviceInfo *old = grabber_get_device_info(self, old_ids[i]);
+		if (old && strcasecmp(old->name, device->devicename) == 0)
+		{
+			device->deviceid = old->deviceid;
+			device->is_direct_touch = old->is_direct_touch;
+			continue;
+		}
+
+		if (device->started)
+		{
+			grabber_stop_movement(self, device, 0);
+		}
+
+		if (device->deviceid < 0)
+		{
+			printf("Device '%s' was removed.\n", device->devicename);
+		}
+		else
+		{
+			printf("Listening to device '%s'\n", device->devicename);
+			grabbing_xinput_grab_start(self, device);
+		}
+	}
+}
+
+static void grabber_xinput_select_hierarchy_events(Grabber *self)
+{
+	unsigned char mask_data[2] = {
+		0,
+	};
+	XISetMask(mask_data, XI_HierarchyChanged);
+	XISetMask(mask_data, XI_DeviceChanged);
+	XIEventMask mask = {
+		XIAllDevices, sizeof(mask_data), mask_data};
+
+	XISelectEvents(self->dpy, DefaultRootWindow(self->dpy), &mask, 1);
+}
+
 /**
  * Clear previous movement data.
  */
-void grabbing_start_movement(Grabber *self, int new_x, int new_y)
+void grabbing_start_movement(Grabber *self, GrabberDevice *device, int new_x,
+							 int new_y)
 {
 
-	self->started = 1;
+	/* another device is drawing a gesture */
+	if (self->active_device && self->active_device != device)
+	{
+		return;
+	}
+
+	self->active_device = device;
+
+	/* the trail of the last gesture is still fading */
+	if (self->fading)
+	{
+		self->fading = 0;
+		backing_restore(&(self->backing));
+	}
 
-	self->fine_direction_sequence[0] = '\0';
-	self->rought_direction_sequence[0] = '\0';
+	self->motion_events = 0;
+	self->frames_drawn = 0;
+	self->draw_requests = 0;
+	self->draw_time = 0;
+	self->draw_pending = 0;
 
-	self->old_x = new_x;
-	self->old_y = new_y;
+	device->started = 1;
 
-	self->rought_old_x = new_x;
-	self->rought_old_y = new_y;
+	/* a reload during the gesture doesn't change the matcher states below */
+	configuration_unref(device->conf);
+	device->conf = configuration_ref(self->conf);
+
+	device->fine_direction_sequence[0] = '\0';
+	device->rought_direction_sequence[0] = '\0';
+
+	device->fine_matcher_state = MATCHER_START_STATE;
+	device->rought_matcher_state = MATCHER_START_STATE;
+
+	device->old_x = new_x;
+	device->old_y = new_y;
+
+	device->rought_old_x = new_x;
+	device->rought_old_y = new_y;
 
 	if (self->brush_image)
 	{
 
-		backing_save(&(self->backing), new_x - self->brush.image_width,
-					 new_y - self->brush.image_height);
-		brush_draw(&(self->brush), self->old_x, self->old_y);
+		brush_draw(&(self->brush), device->old_x, device->old_y);
+		grabber_set_frame_timer(self, 1);
 	}
 	return;
 }
 
-void grabbing_update_movement(Grabber *self, int new_x, int new_y)
+/*
+ * Classify a new pointer position. Every position reaches the stroke
+ * classifier, but the brush is only moved by grabbing_draw_movement, so a
+ * burst of motion events is drawn once.
+ */
+void grabbing_update_movement(Grabber *self, GrabberDevice *device, int new_x,
+							  int new_y)
 {
 
-	if (!self->started)
+	if (!device->started)
 	{
 		return;
 	}
 
-	// se for o caso, desenha o movimento na tela
+	self->motion_events++;
+
 	if (self->brush_image)
 	{
-		backing_save(&(self->backing), new_x - self->brush.image_width,
-					 new_y - self->brush.image_height);
-
-		brush_line_to(&(self->brush), new_x, new_y);
+		self->draw_pending = 1;
+		self->draw_x = new_x;
+		self->draw_y = new_y;
 	}
 
-	int x_delta = (new_x - self->old_x);
-	int y_delta = (new_y - self->old_y);
+	int x_delta = (new_x - device->old_x);
+	int y_delta = (new_y - device->old_y);
 
 	if ((abs(x_delta) > self->delta_min) || (abs(y_delta) > self->delta_min))
 	{
 
 		char stroke = get_fine_direction_from_deltas(x_delta, y_delta);
 
-		movement_add_direction(self->fine_direction_sequence, stroke);
+		grabbing_add_direction(self, device->conf,
+							   device->fine_direction_sequence,
+							   &(device->fine_matcher_state), stroke);
 
 		// reset start position
-		self->old_x = new_x;
-		self->old_y = new_y;
+		device->old_x = new_x;
+		device->old_y = new_y;
 	}
 
-	int rought_delta_x = new_x - self->rought_old_x;
-	int rought_delta_y = new_y - self->rought_old_y;
+	int rought_delta_x = new_x - device->rought_old_x;
+	int rought_delta_y = new_y - device->rought_old_y;
 
 	char rought_direction = get_direction_from_deltas(rought_delta_x,
 													  rought_delta_y);
@@ -662,41 +1097,153 @@ void grabbing_update_movement(Grabber *self, int new_x, int new_y)
 	{
 		// grab stroke
 
-		movement_add_direction(self->rought_direction_sequence,
-							   rought_direction);
+		grabbing_add_direction(self, device->conf,
+							   device->rought_direction_sequence,
+							   &(device->rought_matcher_state), rought_direction);
 
 		// reset start position
-		self->rought_old_x = new_x;
-		self->rought_old_y = new_y;
+		device->rought_old_x = new_x;
+		device->rought_old_y = new_y;
 	}
 
 	return;
 }
 
-/**
- *
+/*
+ * Add the last position given to grabbing_update_movement to the trail.
+ * The trail is shown by the next grabbing_draw_frame.
  */
-void grabbing_end_movement(Grabber *self, int new_x, int new_y,
-						   char *device_name, Configuration *conf)
+void grabbing_draw_movement(Grabber *self)
 {
 
-	grabbing_xinput_grab_stop(self);
-
-	Window focused_window = get_focused_window(self->dpy);
-	Window target_window = focused_window;
+	if (!self->draw_pending)
+	{
+		return;
+	}
 
-	Capture *grab = NULL;
+	self->draw_pending = 0;
 
-	self->started = 0;
+	// se for o caso, desenha o movimento na tela
+	brush_line_to(&(self->brush), self->draw_x, self->draw_y);
 
-	// if is drawing
-	if (self->brush_image)
+	if (self->frame_fd < 0)
 	{
-		backing_restore(&(self->backing));
-	};
-
+		grabbing_draw_frame(self);
+	}
+}
+
+/*
+ * One step of the fade out. The trail is erased when it ends.
+ */
+static void grabber_fade_frame(Grabber *self)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	long elapsed = (now.tv_sec - self->fade_start.tv_sec) * 1000 +
+				   (now.tv_nsec - self->fade_start.tv_nsec) / 1000000;
+
+	if (elapsed >= self->fade_time)
+	{
+		self->fading = 0;
+		grabber_set_frame_timer(self, 0);
+		backing_restore(&(self->backing));
+		return;
+	}
+
+	backing_fade(&(self->backing), 1.0 - (double)elapsed / self->fade_time);
+}
+
+/*
+ * Called when the frame timer expires.
+ */
+void grabbing_draw_frame(Grabber *self)
+{
+	uint64_t expirations;
+
+	/*
+	 * Drain the timer. When called directly it may not have expired yet,
+	 * the frame is drawn anyway.
+	 */
+	if (self->frame_fd >= 0 &&
+		read(self->frame_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+	{
+		expirations = 0;
+	}
+
+	if (self->brush_image && self->active_device)
+	{
+		unsigned long first_request = NextRequest(self->dpy);
+
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		if (brush_flush(&(self->brush)))
+		{
+			clock_gettime(CLOCK_MONOTONIC, &end);
+
+			self->frames_drawn++;
+			self->draw_requests += NextRequest(self->dpy) - first_request;
+			self->draw_time += (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+		}
+	}
+	else if (self->fading)
+	{
+		grabber_fade_frame(self);
+	}
+}
+
+/*
+ * What drawing the last gesture cost, printed with --verbose.
+ */
+static void grabber_print_drawing_stats(Grabber *self)
+{
+	printf("     Motion      : %lu events, %lu frames drawn\n",
+		   self->motion_events, self->frames_drawn);
+	if (self->brush_image)
+	{
+		printf("     Drawing     : %lu X requests in %ld us\n",
+			   self->draw_requests, self->draw_time);
+	}
+	if (self->brush_image && !self->overlay)
+	{
+		printf("     Backing     : %d tiles, %lu KB copied\n",
+			   self->backing.tiles_saved, self->backing.bytes_copied / 1024);
+	}
+	if (self->brush_image && self->backing.raster)
+	{
+		printf("     Raster      : %lu KB sent (%s)\n",
+			   self->backing.bytes_copied / 1024,
+			   self->backing.raster->shm ? "MIT-SHM" : "XPutImage");
+	}
+}
+
+/**
+ *
+ */
+void grabbing_end_movement(Grabber *self, GrabberDevice *device, int new_x,
+						   int new_y, char *device_name)
+{
+
+	/* the press was ignored while another device was drawing */
+	if (!device->started)
+	{
+		return;
+	}
+
+	Configuration *conf = configuration_ref(device->conf);
+
+	grabbing_xinput_grab_stop(self, device);
+
+	Window focused_window = get_focused_window(self->dpy);
+	Window target_window = focused_window;
+
+	Capture *grab = NULL;
+
+	grabber_stop_movement(self, device, 1);
+
 	// if there is no gesture
-	if ((strlen(self->rought_direction_sequence) == 0) && (strlen(self->fine_direction_sequence) == 0))
+	if ((strlen(device->rought_direction_sequence) == 0) && (strlen(device->fine_direction_sequence) == 0))
 	{
 
 		if (!(self->synaptics))
@@ -704,9 +1251,7 @@ void grabbing_end_movement(Grabber *self, int new_x, int new_y,
 
 			printf("\nEmulating click\n");
 
-			//grabbing_xinput_grab_stop(self);
-			mouse_click(self->dpy, self->button, new_x, new_y);
-			//grabbing_xinput_grab_start(self);
+			mouse_click(self->dpy, device->button, new_x, new_y);
 		}
 	}
 	else
@@ -715,8 +1260,17 @@ void grabbing_end_movement(Grabber *self, int new_x, int new_y,
 		int expression_count = 2;
 		char **expression_list = malloc(sizeof(char *) * expression_count);
 
-		expression_list[0] = self->fine_direction_sequence;
-		expression_list[1] = self->rought_direction_sequence;
+		expression_list[0] = device->fine_direction_sequence;
+		expression_list[1] = device->rought_direction_sequence;
+
+		int *matcher_state_list = NULL;
+
+		if (conf->matcher)
+		{
+			matcher_state_list = malloc(sizeof(int) * expression_count);
+			matcher_state_list[0] = device->fine_matcher_state;
+			matcher_state_list[1] = device->rought_matcher_state;
+		}
 
 		ActiveWindowInfo *window_info = get_active_window_info(self->dpy,
 															   target_window);
@@ -725,6 +1279,7 @@ void grabbing_end_movement(Grabber *self, int new_x, int new_y,
 
 		grab->expression_count = expression_count;
 		grab->expression_list = expression_list;
+		grab->matcher_state_list = matcher_state_list;
 		grab->active_window_info = window_info;
 	}
 
@@ -736,22 +1291,31 @@ void grabbing_end_movement(Grabber *self, int new_x, int new_y,
 		printf("     Window class: \"%s\"\n", grab->active_window_info->class);
 		printf("     Device      : \"%s\"\n", device_name);
 
+		if (self->verbose)
+		{
+			grabber_print_drawing_stats(self);
+		}
+
+		struct timespec match_start, match_end;
+		clock_gettime(CLOCK_MONOTONIC, &match_start);
+
 		Gesture *gest = configuration_process_gesture(conf, grab);
 
+		clock_gettime(CLOCK_MONOTONIC, &match_end);
+
+		if (self->verbose)
+		{
+			printf("     Match time  : %ld us (%i gestures)\n",
+				   (match_end.tv_sec - match_start.tv_sec) * 1000000 + (match_end.tv_nsec - match_start.tv_nsec) / 1000,
+				   configuration_get_gestures_count(conf));
+		}
+
 		if (gest)
 		{
 			printf("     Movement '%s' matched gesture '%s' on context '%s'\n",
 				   gest->movement->name, gest->name, gest->context->name);
 
-			int j = 0;
-
-			for (j = 0; j < gest->action_count; ++j)
-			{
-				Action *a = gest->action_list[j];
-				printf("     Executing action: %s %s\n",
-					   get_action_name(a->type), a->original_str);
-				execute_action(self->dpy, a, target_window);
-			}
+			execute_gesture(self, gest, target_window);
 		}
 		else
 		{
@@ -770,7 +1334,9 @@ void grabbing_end_movement(Grabber *self, int new_x, int new_y,
 		free_grabbed(grab);
 	}
 
-	grabbing_xinput_grab_start(self);
+	configuration_unref(conf);
+
+	grabbing_xinput_grab_start(self, device);
 }
 
 void grabber_set_button(Grabber *self, int button)
@@ -778,140 +1344,496 @@ void grabber_set_button(Grabber *self, int button)
 	self->button = button;
 }
 
-void grabber_set_device(Grabber *self, char *device_name)
+void grabber_add_device(Grabber *self, char *device_name)
 {
-	self->devicename = device_name;
+	self->device_list = realloc(self->device_list,
+								sizeof(GrabberDevice) * (self->device_count + 1));
+
+	GrabberDevice *device = &self->device_list[self->device_count++];
+	bzero(device, sizeof(GrabberDevice));
 
-	if (strcasecmp(self->devicename, "SYNAPTICS") == 0)
+	device->devicename = device_name;
+	device->deviceid = -1;
+	device->button = self->button;
+
+	device->fine_direction_sequence = malloc(sizeof(char *) * 30);
+	device->rought_direction_sequence = malloc(sizeof(char *) * 30);
+
+	device->fine_direction_sequence[0] = '\0';
+	device->rought_direction_sequence[0] = '\0';
+
+	if (strcasecmp(device_name, "SYNAPTICS") == 0)
 	{
 		self->synaptics = 1;
 		self->delta_min = 200;
 	}
+}
+
+void grabber_set_brush_color(Grabber *self, char *brush_color)
+{
+	if (!brush_color)
+	{
+		self->painting = 0;
+	}
+	else if (brush_image_parse_color(brush_color, self->brush_color))
+	{
+		fprintf(stderr, "Unknown brush color '%s'. Not drawing the gestures.\n",
+				brush_color);
+		self->painting = 0;
+	}
 	else
 	{
-		self->synaptics = 0;
-		self->delta_min = 30;
+		self->painting = 1;
 	}
 }
 
-void grabber_set_brush_color(Grabber *self, char *brush_color)
+void grabber_set_brush_width(Grabber *self, int width)
+{
+	if (width <= 0)
+	{
+		width = BRUSH_IMAGE_WIDTH;
+	}
+	else if (width > BRUSH_IMAGE_MAX_WIDTH)
+	{
+		width = BRUSH_IMAGE_MAX_WIDTH;
+	}
+
+	self->brush_width = width;
+}
+
+void grabber_set_overlay(Grabber *self, int enable)
+{
+	self->overlay = enable;
+}
+
+void grabber_set_raster(Grabber *self, int enable)
+{
+	self->raster = enable;
+}
+
+void grabber_set_fade(Grabber *self, int milliseconds)
 {
-	self->brush_image = get_brush_image(brush_color);
+	self->fade_time = milliseconds > 0 ? milliseconds : 0;
 }
 
-Grabber *grabber_new(char *device_name, int button)
+void grabber_set_verbose(Grabber *self, int enable)
+{
+	self->verbose = enable;
+}
+
+Grabber *grabber_new(int button)
 {
 
 	Grabber *self = malloc(sizeof(Grabber));
 	bzero(self, sizeof(Grabber));
 
-	self->fine_direction_sequence = malloc(sizeof(char *) * 30);
-	self->rought_direction_sequence = malloc(sizeof(char *) * 30);
+	self->synaptics = 0;
+	self->delta_min = 30;
+	self->frame_fd = -1;
+	self->config_watch_fd = -1;
+	self->reload_fd = -1;
+	self->randr_event = -1;
+	self->brush_width = BRUSH_IMAGE_WIDTH;
 
-	grabber_set_device(self, device_name);
 	grabber_set_button(self, button);
 
 	return self;
 }
 
-char *get_device_name_from_event(Grabber *self, XIDeviceEvent *data)
+static GrabberDevice *grabber_find_device(Grabber *self, int deviceid)
 {
-	int ndevices;
-	char *device_name = NULL;
-	XIDeviceInfo *device;
-	XIDeviceInfo *devices;
-	devices = XIQueryDevice(self->dpy, data->deviceid, &ndevices);
-	if (ndevices == 1)
+	for (int i = 0; i < self->device_count; ++i)
 	{
-		device = &devices[0];
-		device_name = strdup(device->name);
+		if (self->device_list[i].deviceid == deviceid)
+		{
+			return &self->device_list[i];
+		}
 	}
-
-	return device_name;
+	return NULL;
 }
 
 void grabber_list_devices(Grabber *self)
 {
+	if (!self->dpy)
+	{
+		grabber_open_display(self);
+	}
 	grabber_xinput_open_devices(self, True);
 };
 
-void grabber_xinput_loop(Grabber *self, Configuration *conf)
+void grabber_xinput_loop(Grabber *self)
 {
 
 	XEvent ev;
 
+	struct timespec start, ready;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	grabber_xinput_select_hierarchy_events(self);
 	grabber_xinput_open_devices(self, False);
-	grabbing_xinput_grab_start(self);
+
+	for (int i = 0; i < self->device_count; ++i)
+	{
+		GrabberDevice *device = &self->device_list[i];
+
+		if (device->deviceid < 0)
+		{
+			printf("Device '%s' not found.\n", device->devicename);
+			continue;
+		}
+
+		printf("Listening to device '%s'\n", device->devicename);
+		grabbing_xinput_grab_start(self, device);
+	}
+
+	XSync(self->dpy, False);
+	clock_gettime(CLOCK_MONOTONIC, &ready);
+
+	printf("Grabbing %d device(s) on one connection. Ready in %ld us\n\n",
+		   self->device_count,
+		   (ready.tv_sec - start.tv_sec) * 1000000 + (ready.tv_nsec - start.tv_nsec) / 1000);
 
 	while (!self->shut_down)
 	{
 
+		/* every event that arrived was handled. sleep until more come or a frame is due */
+		if (!XPending(self->dpy))
+		{
+			grabbing_draw_movement(self);
+			/* the loop is broken, stop like on SIGTERM instead of spinning */
+			if (eventloop_wait(self->loop, -1) < 0)
+			{
+				self->shut_down = 1;
+			}
+			continue;
+		}
+
 		XNextEvent(self->dpy, &ev);
 
+		if (grabber_handle_event(self, &ev))
+		{
+			continue;
+		}
+
 		if (ev.xcookie.type == GenericEvent && ev.xcookie.extension == self->opcode && XGetEventData(self->dpy, &ev.xcookie))
 		{
 
-			XIDeviceEvent *data = NULL;
+			XIDeviceEvent *data = (XIDeviceEvent *)ev.xcookie.data;
+			GrabberDevice *device = NULL;
 
 			switch (ev.xcookie.evtype)
 			{
 
-			case XI_Motion:
-				data = (XIDeviceEvent *)ev.xcookie.data;
-				grabbing_update_movement(self, data->root_x, data->root_y);
+			case XI_HierarchyChanged:
+				grabber_xinput_update_devices(self);
 				break;
 
-			case XI_ButtonPress:
-				data = (XIDeviceEvent *)ev.xcookie.data;
-				grabbing_start_movement(self, data->root_x, data->root_y);
+			case XI_DeviceChanged:
+				/* the master pointer also sends it every time its slave changes */
+				if (((XIDeviceChangedEvent *)ev.xcookie.data)->reason == XIDeviceChange)
+				{
+					grabber_xinput_update_devices(self);
+				}
 				break;
 
+			case XI_Motion:
+			case XI_ButtonPress:
 			case XI_ButtonRelease:
-				data = (XIDeviceEvent *)ev.xcookie.data;
+				device = grabber_find_device(self, data->deviceid);
+				break;
+			}
+
+			if (device)
+			{
+				switch (ev.xcookie.evtype)
+				{
 
-				char *device_name = get_device_name_from_event(self, data);
+				case XI_Motion:
+					grabbing_update_movement(self, device, data->root_x,
+											 data->root_y);
+					break;
 
-				grabbing_xinput_grab_stop(self);
-				grabbing_end_movement(self, data->root_x, data->root_y,
-									  device_name, conf);
-				grabbing_xinput_grab_start(self);
-				break;
+				case XI_ButtonPress:
+					grabbing_start_movement(self, device, data->root_x,
+											data->root_y);
+					break;
+
+				case XI_ButtonRelease:
+				{
+					DeviceInfo *info = grabber_get_device_info(self,
+															   data->deviceid);
+
+					grabbing_end_movement(self, device, data->root_x,
+										  data->root_y,
+										  info ? info->name : device->devicename);
+					break;
+				}
+				}
 			}
 		}
 		XFreeEventData(self->dpy, &ev.xcookie);
 	}
 }
 
+/*
+ * The X connection is read by the loops themselves, with XPending. Reading
+ * here only moves what arrived to the queue of Xlib.
+ */
+static void grabber_on_x_connection(int fd, void *data)
+{
+	Grabber *self = data;
+	XEventsQueued(self->dpy, QueuedAfterReading);
+}
+
+static void grabber_on_signal(int fd, void *data)
+{
+	Grabber *self = data;
+	struct signalfd_siginfo info;
+
+	while (read(fd, &info, sizeof(info)) == sizeof(info))
+	{
+		printf("\nReceived signal %d. Shutting down.\n", info.ssi_signo);
+		self->shut_down = 1;
+	}
+}
+
+/*
+ * Everything the loops wait on goes through self->loop, so other parts of
+ * the program can add their own fds and timers with eventloop_add.
+ */
+static void grabber_init_loop(Grabber *self)
+{
+	static const int signals[] = {SIGINT, SIGTERM};
+
+	self->loop = eventloop_new();
+	if (!self->loop)
+	{
+		exit(-1);
+	}
+
+	eventloop_add(self->loop, ConnectionNumber(self->dpy), grabber_on_x_connection, self);
+
+	/* after the launcher was forked, so the commands it starts get the signals */
+	eventloop_add_signals(self->loop, signals, 2, grabber_on_signal, self);
+}
+
+/*
+ * Load the configuration file again. It is swapped for the current one only
+ * if it can be parsed. Gestures being drawn finish with the old one, which
+ * is freed after the last of them ends.
+ */
+void grabber_reload_configuration(Grabber *self)
+{
+	if (!self->conf->filename)
+	{
+		printf("The configuration was not loaded from a file. Not reloading.\n");
+		return;
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	Configuration *conf = configuration_new();
+
+	if (configuration_load_from_file(conf, self->conf->filename) != 0)
+	{
+		printf("Keeping the current configuration.\n");
+		configuration_unref(conf);
+		return;
+	}
+
+	configuration_unref(self->conf);
+	self->conf = conf;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf("Configuration reloaded in %ld us\n",
+		   (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000);
+}
+
+static void grabber_on_reload_timer(int fd, void *data)
+{
+	uint64_t expirations;
+
+	if (read(fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+	{
+		grabber_reload_configuration((Grabber *)data);
+	}
+}
+
+static void grabber_on_config_changed(int fd, void *data)
+{
+	Grabber *self = data;
+	char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t bytes;
+	int changed = 0;
+
+	const char *file_name = strrchr(self->conf->filename, '/');
+	file_name = file_name ? file_name + 1 : self->conf->filename;
+
+	while ((bytes = read(fd, buffer, sizeof(buffer))) > 0)
+	{
+		struct inotify_event *event;
+
+		for (char *p = buffer; p < buffer + bytes; p += sizeof(struct inotify_event) + event->len)
+		{
+			event = (struct inotify_event *)p;
+
+			if (event->len && strcmp(event->name, file_name) == 0)
+			{
+				changed = 1;
+			}
+		}
+	}
+
+	if (changed)
+	{
+		eventloop_set_timer(self->reload_fd, RELOAD_DELAY_NS, 0);
+	}
+}
+
+/*
+ * Watch the directory instead of the file: editors usually save by renaming
+ * a new file over the old one.
+ */
+static void grabber_init_config_watch(Grabber *self)
+{
+	if (!self->conf->filename)
+	{
+		return;
+	}
+
+	self->config_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	if (self->config_watch_fd < 0)
+	{
+		perror("In inotify_init1()");
+		return;
+	}
+
+	char *dir = strdup(self->conf->filename);
+	char *slash = strrchr(dir, '/');
+
+	if (slash == dir)
+	{
+		slash[1] = '\0';
+	}
+	else if (slash)
+	{
+		*slash = '\0';
+	}
+	else
+	{
+		strcpy(dir, ".");
+	}
+
+	if (inotify_add_watch(self->config_watch_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+	{
+		fprintf(stderr, "Can't watch '%s' for changes: %s\n", dir, strerror(errno));
+		close(self->config_watch_fd);
+		self->config_watch_fd = -1;
+		free(dir);
+		return;
+	}
+
+	free(dir);
+
+	self->reload_fd = eventloop_add_timer(self->loop, grabber_on_reload_timer, self);
+	eventloop_add(self->loop, self->config_watch_fd, grabber_on_config_changed, self);
+
+	if (self->verbose)
+	{
+		printf("Watching '%s' for changes\n", self->conf->filename);
+	}
+}
+
 void grabber_loop(Grabber *self, Configuration *conf)
 {
 
+	/* replaced by grabber_reload_configuration */
+	self->conf = configuration_ref(conf);
+
+	/* fork the launcher before opening the display, so it doesn't share it */
+	self->launcher = launcher_new(self->verbose);
+
 	grabber_open_display(self);
 
+	grabber_init_loop(self);
+
+	grabber_init_config_watch(self);
+
 	grabber_init_drawing(self);
 
+	grabber_init_frame_timer(self);
+
 	if (self->synaptics)
 	{
-		grabber_synaptics_loop(self, conf);
+		/* prefer the kernel device. the synaptics shared memory needs a patched driver */
+		if (grabber_evdev_loop(self) != 0)
+		{
+			grabber_synaptics_loop(self);
+		}
 	}
 	else
 	{
-		grabber_xinput_loop(self, conf);
+		grabber_xinput_loop(self);
 	}
 
-	printf("Grabbing loop finished for device '%s'.\n", self->devicename);
-}
-
-char *grabber_get_device_name(Grabber *self)
-{
-	return self->devicename;
+	printf("Grabbing loop finished.\n");
 }
 
+/*
+ * Ungrab the devices, put the screen back and close everything. Called
+ * after grabber_loop returns.
+ */
 void grabber_finalize(Grabber *self)
 {
+	for (int i = 0; i < self->device_count; ++i)
+	{
+		GrabberDevice *device = &self->device_list[i];
+
+		if (!self->synaptics)
+		{
+			grabbing_xinput_grab_stop(self, device);
+		}
+		device->started = 0;
+
+		configuration_unref(device->conf);
+		device->conf = NULL;
+	}
+	self->active_device = NULL;
+
+	configuration_unref(self->conf);
+	self->conf = NULL;
+
 	if (self->brush_image)
 	{
+		backing_restore(&(self->backing));
+
 		brush_deinit(&(self->brush));
 		backing_deinit(&(self->backing));
+
+		brush_image_free(self->brush_image);
+		self->brush_image = NULL;
+		brush_image_free(self->brush_shadow);
+		self->brush_shadow = NULL;
+	}
+
+	launcher_free(self->launcher);
+	self->launcher = NULL;
+
+	grabber_clear_device_info(self);
+
+	/* closes the frame and reload timers too */
+	eventloop_free(self->loop);
+	self->loop = NULL;
+	self->frame_fd = -1;
+	self->reload_fd = -1;
+
+	if (self->config_watch_fd >= 0)
+	{
+		close(self->config_watch_fd);
+		self->config_watch_fd = -1;
 	}
 
 	XCloseDisplay(self->dpy);
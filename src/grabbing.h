@@ -22,6 +22,8 @@
 #include "drawing/drawing-backing.h"
 #include "drawing/drawing-brush.h"
 #include "configuration.h"
+#include "launcher.h"
+#include "eventloop.h"
 
 /* modifier keys */
 enum
@@ -42,59 +44,162 @@ extern const char *modifiers_names[];
 /* valid strokes */
 extern const char _STROKE_CHARS[];
 
+/* state of one grabbed device */
 typedef struct
 {
 
-	Display *dpy;
-
 	char *devicename;
 	int deviceid;
 	int is_direct_touch;
 
+	int button;
+	int started;
+
+	int old_x;
+	int old_y;
+
+	int rought_old_x;
+	int rought_old_y;
+
+	char *fine_direction_sequence;
+	char *rought_direction_sequence;
+
+	/* matcher states reached by the sequences above */
+	int fine_matcher_state;
+	int rought_matcher_state;
+
+	/* the configuration the gesture started with, kept until it ends */
+	Configuration *conf;
+
+} GrabberDevice;
+
+/* what is known about an xinput pointer device, grabbed or not */
+typedef struct
+{
+
+	int deviceid;
+	int use;
+	int is_direct_touch;
+	char *name;
+
+} DeviceInfo;
+
+/*
+ * Every grabbed device is handled by a single process and X connection.
+ * Events are dispatched to the device state by their deviceid.
+ */
+typedef struct
+{
+
+	Display *dpy;
+
+	GrabberDevice *device_list;
+	int device_count;
+
+	/* every pointer device of the server, kept current by XI_HierarchyChanged */
+	DeviceInfo *device_info_list;
+	int device_info_count;
+
+	/* the device drawing the current gesture. there is a single brush */
+	GrabberDevice *active_device;
+
+	/* 0 to use the default button of each device */
 	int button;
 	int any_modifier;
 	int follow_pointer;
 	int focus;
 
-	int started;
 	int verbose;
 
 	int opcode;
 	int event;
 	int error;
 
-	int old_x;
-	int old_y;
+	/* first event of the RandR extension, -1 without it */
+	int randr_event;
 
 	int delta_min;
 
 	int synaptics;
 
-	int rought_old_x;
-	int rought_old_y;
+	Configuration *conf;
 
-	char *fine_direction_sequence;
-	char *rought_direction_sequence;
+	Launcher *launcher;
+
+	/* draw on a transparent window instead of the root window */
+	int overlay;
+
+	/* draw the overlay on the client, see backing_init_raster */
+	int raster;
 
 	backing_t backing;
 	brush_t brush;
 
+	/* timerfd ticking at the refresh rate while a gesture is drawn */
+	int frame_fd;
+	long frame_interval;
+
+	/* last position not drawn yet, see grabbing_draw_movement */
+	int draw_pending;
+	int draw_x;
+	int draw_y;
+
+	/* statistics of the current gesture */
+	unsigned long motion_events;
+	unsigned long frames_drawn;
+	unsigned long draw_requests;
+	long draw_time;
+
+	/* the trail fades out for fade_time ms after a gesture, 0 to erase it at once */
+	int fade_time;
+	int fading;
+	struct timespec fade_start;
+
+	/* set by SIGINT or SIGTERM. the loop ends, see grabber_finalize */
 	int shut_down;
 
+	/* every fd the grabbing loops wait on */
+	EventLoop *loop;
+
+	/* inotify on the directory of the configuration file, -1 if not watched */
+	int config_watch_fd;
+	/* a burst of writes to the file is reloaded once, when this expires */
+	int reload_fd;
+
+	/* draw the gesture on screen, with these */
+	int painting;
+	unsigned char brush_color[4];
+	int brush_width;
+
+	/* generated by grabber_init_drawing, NULL when not painting */
 	struct brush_image_t *brush_image;
+	struct brush_image_t *brush_shadow;
 
 } Grabber;
 
-Grabber *grabber_new(char *device_name, int button);
+Grabber *grabber_new(int button);
+void grabber_add_device(Grabber *self, char *device_name);
 void grabber_loop(Grabber *self, Configuration *conf);
-void grabbing_start_movement(Grabber *self, int new_x, int new_y);
-void grabbing_update_movement(Grabber *self, int new_x, int new_y);
-void grabbing_end_movement(Grabber *self, int new_x, int new_y,
-						   char *device_name, Configuration *conf);
+void grabbing_start_movement(Grabber *self, GrabberDevice *device, int new_x,
+							 int new_y);
+void grabbing_update_movement(Grabber *self, GrabberDevice *device, int new_x,
+							  int new_y);
+void grabbing_draw_movement(Grabber *self);
+void grabbing_draw_frame(Grabber *self);
+void grabbing_end_movement(Grabber *self, GrabberDevice *device, int new_x,
+						   int new_y, char *device_name);
+void grabber_reload_configuration(Grabber *self);
+
+int grabber_handle_event(Grabber *self, XEvent *ev);
 
 void grabber_finalize(Grabber *self);
 void grabber_print_devices(Grabber *self);
 void grabber_set_brush_color(Grabber *self, char *brush_color);
+void grabber_set_brush_width(Grabber *self, int width);
+void grabber_set_overlay(Grabber *self, int enable);
+void grabber_set_raster(Grabber *self, int enable);
+void grabber_set_fade(Grabber *self, int milliseconds);
+void grabber_set_verbose(Grabber *self, int enable);
 void grabber_any_modifier(Grabber *self, int enable);
 void grabber_list_devices(Grabber *self);
 void grabber_follow_pointer(Grabber *self, int enable);
@@ -0,0 +1,289 @@
+/*
+ Copyright 2016 Lucas Augusto Deters
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2, or (at your option)
+ any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ one line to give the program's name and an idea of what it does.
+ */
+
+#define _GNU_SOURCE /* needed by SOCK_CLOEXEC */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "launcher.h"
+
+extern char **environ;
+
+/* commands with any of these need /bin/sh to be understood */
+static const char * SHELL_METACHARACTERS = "|&;<>()$`\\\"'*?[]#~=%{}!\n";
+
+struct launcher_message {
+	struct timespec sent;
+	char command[LAUNCHER_COMMAND_MAX];
+};
+
+static long elapsed_us(struct timespec * from, struct timespec * to) {
+	return (to->tv_sec - from->tv_sec) * 1000000
+			+ (to->tv_nsec - from->tv_nsec) / 1000;
+}
+
+static void on_child_exit(int sig) {
+
+	int saved_errno = errno;
+
+	while (waitpid(-1, NULL, WNOHANG) > 0) {
+	}
+
+	errno = saved_errno;
+}
+
+static void launcher_reap_children() {
+
+	struct sigaction action;
+	bzero(&action, sizeof(struct sigaction));
+
+	action.sa_handler = on_child_exit;
+	action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	sigemptyset(&action.sa_mask);
+
+	sigaction(SIGCHLD, &action, NULL);
+}
+
+/*
+ * Start a command without waiting for it. Simple commands are started
+ * directly; everything else goes through /bin/sh.
+ */
+static pid_t launcher_spawn(char * command) {
+
+	pid_t pid = -1;
+	int err = 0;
+
+	char * copy = strdup(command);
+	char * argv[LAUNCHER_ARGS_MAX + 1];
+	int argc = 0;
+
+	char * rest = copy;
+	char * token = NULL;
+
+	/*
+	 * The grabber blocks SIGINT and SIGTERM for its event loop, see
+	 * eventloop_add_signals. The command must not inherit that.
+	 */
+	posix_spawnattr_t attr;
+	sigset_t mask;
+	sigset_t defaults;
+
+	sigemptyset(&mask);
+	sigemptyset(&defaults);
+	sigaddset(&defaults, SIGINT);
+	sigaddset(&defaults, SIGTERM);
+
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setsigmask(&attr, &mask);
+	posix_spawnattr_setsigdefault(&attr, &defaults);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+	if (!strpbrk(command, SHELL_METACHARACTERS)) {
+		while (argc < LAUNCHER_ARGS_MAX && (token = strsep(&rest, " \t"))) {
+			if (*token) {
+				argv[argc++] = token;
+			}
+		}
+	}
+
+	if (argc && (!rest || rest[strspn(rest, " \t")] == '\0')) {
+
+		argv[argc] = NULL;
+		err = posix_spawnp(&pid, argv[0], NULL, &attr, argv, environ);
+
+	} else if (command[strspn(command, " \t")] != '\0') {
+
+		char * shell_argv[] = { "sh", "-c", command, NULL };
+		err = posix_spawn(&pid, "/bin/sh", NULL, &attr, shell_argv, environ);
+
+	}
+
+	posix_spawnattr_destroy(&attr);
+	free(copy);
+
+	if (err) {
+		fprintf(stderr, "Error starting '%s': %s\n", command, strerror(err));
+		return -1;
+	}
+
+	return pid;
+}
+
+/* print how long starting each command took */
+static int launcher_verbose;
+
+static void launcher_run(char * command, struct timespec * sent) {
+
+	struct timespec started;
+
+	pid_t pid = launcher_spawn(command);
+
+	clock_gettime(CLOCK_MONOTONIC, &started);
+
+	if (pid <= 0) {
+		return;
+	}
+
+	if (launcher_verbose) {
+		printf("     Started '%s' (pid %d) in %ld us\n", command, pid,
+				elapsed_us(sent, &started));
+	} else {
+		printf("     Started '%s' (pid %d)\n", command, pid);
+	}
+
+	fflush(stdout);
+}
+
+static void launcher_serve(int fd) {
+
+	struct launcher_message message;
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+
+	launcher_reap_children();
+
+	while (1) {
+
+		ssize_t n = recv(fd, &message, sizeof(message), 0);
+
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+
+		/* the grabber is gone */
+		if (n <= 0) {
+			break;
+		}
+
+		if (n <= offsetof(struct launcher_message, command)) {
+			continue;
+		}
+
+		((char *) &message)[n - 1] = '\0';
+
+		launcher_run(message.command, &message.sent);
+	}
+
+	close(fd);
+}
+
+Launcher * launcher_new(int verbose) {
+
+	int fds[2];
+
+	/* also used by launcher_execute without a helper */
+	launcher_verbose = verbose;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+		perror("In socketpair()");
+		return NULL;
+	}
+
+	fflush(stdout);
+
+	pid_t pid = fork();
+
+	if (pid < 0) {
+		perror("In fork()");
+		close(fds[0]);
+		close(fds[1]);
+		return NULL;
+	}
+
+	if (pid == 0) {
+		close(fds[0]);
+		launcher_serve(fds[1]);
+		_exit(0);
+	}
+
+	close(fds[1]);
+
+	Launcher * self = malloc(sizeof(Launcher));
+	bzero(self, sizeof(Launcher));
+
+	self->pid = pid;
+	self->fd = fds[0];
+
+	return self;
+}
+
+void launcher_free(Launcher * self) {
+
+	if (!self) {
+		return;
+	}
+
+	if (self->fd >= 0) {
+		close(self->fd);
+		waitpid(self->pid, NULL, 0);
+	}
+
+	free(self);
+}
+
+/*
+ * Ask the helper process to start a command. If there is no helper, the
+ * command is started from the calling process.
+ */
+void launcher_execute(Launcher * self, char * command) {
+
+	assert(command);
+
+	struct launcher_message message;
+	clock_gettime(CLOCK_MONOTONIC, &message.sent);
+
+	size_t length = strlen(command);
+
+	if (length >= LAUNCHER_COMMAND_MAX) {
+		fprintf(stderr, "Command is too long to be started: '%.32s...'\n",
+				command);
+		return;
+	}
+
+	if (self && self->fd >= 0) {
+
+		memcpy(message.command, command, length + 1);
+
+		if (send(self->fd, &message,
+				offsetof(struct launcher_message, command) + length + 1,
+				MSG_NOSIGNAL) >= 0) {
+			return;
+		}
+
+		perror("In send()");
+		close(self->fd);
+		self->fd = -1;
+	}
+
+	launcher_reap_children();
+	launcher_run(command, &message.sent);
+}
@@ -0,0 +1,38 @@
+/*
+ Copyright 2016 Lucas Augusto Deters
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2, or (at your option)
+ any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ one line to give the program's name and an idea of what it does.
+ */
+
+#ifndef MYGESTURES_LAUNCHER_H_
+#define MYGESTURES_LAUNCHER_H_
+
+#include <sys/types.h>
+
+#define LAUNCHER_COMMAND_MAX 4096
+#define LAUNCHER_ARGS_MAX 64
+
+/*
+ * A small helper process, forked before the grabber opens its display, that
+ * starts the commands of ACTION_EXECUTE and reaps them when they exit.
+ */
+typedef struct launcher_ {
+	pid_t pid;
+	int fd;
+} Launcher;
+
+Launcher * launcher_new(int verbose);
+void launcher_free(Launcher * self);
+void launcher_execute(Launcher * self, char * command);
+
+#endif
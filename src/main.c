@@ -36,13 +36,19 @@ static void process_arguments(Mygestures *self, int argc, char *const *argv)
 		{"help", no_argument, 0, 'h'},
 		{"visual", no_argument, 0, 'v'},
 		{"multitouch", no_argument, 0, 'm'},
+		{"overlay", no_argument, 0, 'o'},
+		{"raster", no_argument, 0, 'r'},
+		{"brush-width", required_argument, 0, 'w'},
+		{"fade", required_argument, 0, 'f'},
+		{"check", no_argument, 0, 'k'},
+		{"verbose", no_argument, 0, 'V'},
 		{0, 0, 0, 0}};
 
 	/* read params */
 
 	while (1)
 	{
-		opt = getopt_long(argc, argv, "b:c:d:vhlm", opts, NULL);
+		opt = getopt_long(argc, argv, "b:c:d:f:w:vVhklmor", opts, NULL);
 		if (opt == -1)
 			break;
 
@@ -61,6 +67,14 @@ static void process_arguments(Mygestures *self, int argc, char *const *argv)
 			self->multitouch = 1;
 			break;
 
+		case 'o':
+			self->overlay = 1;
+			break;
+
+		case 'r':
+			self->raster = 1;
+			break;
+
 		case 'v':
 			if (!(self->brush_color))
 			{
@@ -72,6 +86,14 @@ static void process_arguments(Mygestures *self, int argc, char *const *argv)
 			self->brush_color = strdup(optarg);
 			break;
 
+		case 'w':
+			self->brush_width = atoi(optarg);
+			break;
+
+		case 'f':
+			self->fade = atoi(optarg);
+			break;
+
 		case 'l':
 			self->list_devices_flag = 1;
 			break;
@@ -79,6 +101,14 @@ static void process_arguments(Mygestures *self, int argc, char *const *argv)
 		case 'h':
 			self->help_flag = 1;
 			break;
+
+		case 'k':
+			self->check_flag = 1;
+			break;
+
+		case 'V':
+			self->verbose = 1;
+			break;
 		}
 	}
 
@@ -190,7 +220,10 @@ static void release_shared_memory()
 	}
 }
 
-void on_interrupt(int a)
+/*
+ * Release the shared memory before exiting, unless another instance took it.
+ */
+void release_instance()
 {
 
 	if (message->kill)
@@ -200,10 +233,20 @@ void on_interrupt(int a)
 	}
 	else
 	{
-		printf("\nReceived the interrupt signal.\n");
 		release_shared_memory();
 	}
+}
 
+/*
+ * Before the grabbing loop starts, the signals still arrive here.
+ */
+void on_interrupt(int a)
+{
+	if (!message->kill)
+	{
+		printf("\nReceived the interrupt signal.\n");
+	}
+	release_instance();
 	exit(0);
 }
 
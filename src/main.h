@@ -1,6 +1,7 @@
 
 
 void on_interrupt(int a);
+void release_instance();
 void on_kill(int a);
 
 void release_shared_memory();
@@ -0,0 +1,829 @@
+/*
+ Copyright 2016 Lucas Augusto Deters
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2, or (at your option)
+ any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ one line to give the program's name and an idea of what it does.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <regex.h>
+#include <assert.h>
+
+#include "matcher.h"
+
+/* limits for {m,n} bounds, to keep the automaton small */
+#define MATCHER_MAX_REPEAT 64
+
+/*
+ * Movement expressions are parsed into a syntax tree, compiled into a
+ * Thompson NFA with one accepting state per movement, and then converted
+ * into a DFA by subset construction over the stroke alphabet.
+ */
+
+enum {
+	NODE_EMPTY, NODE_SET, NODE_CAT, NODE_ALT, NODE_STAR, NODE_PLUS, NODE_QUEST, NODE_REPEAT
+};
+
+typedef struct node_ {
+	int type;
+	unsigned int set;
+	int min;
+	int max;
+	struct node_ * left;
+	struct node_ * right;
+} Node;
+
+typedef struct parser_ {
+	const char * pos;
+	Matcher * matcher;
+	int error;
+} Parser;
+
+typedef struct nfa_state_ {
+	int consume;
+	unsigned int set;
+	int out;
+	int out1;
+	int accept;
+} NfaState;
+
+typedef struct nfa_ {
+	NfaState * state_list;
+	int state_count;
+	int state_size;
+} Nfa;
+
+typedef struct fragment_ {
+	int start;
+	int end;
+} Fragment;
+
+static Node * parse_alternation(Parser * p);
+
+static Node * node_new(int type, Node * left, Node * right) {
+	Node * node = malloc(sizeof(Node));
+	bzero(node, sizeof(Node));
+	node->type = type;
+	node->left = left;
+	node->right = right;
+	return node;
+}
+
+static void node_free(Node * node) {
+	if (!node) {
+		return;
+	}
+	node_free(node->left);
+	node_free(node->right);
+	free(node);
+}
+
+static unsigned int symbol_set_of_char(Matcher * self, unsigned char c) {
+	int index = self->stroke_index[c];
+	return (index < 0) ? 0 : (1u << index);
+}
+
+static Node * parse_bracket(Parser * p) {
+
+	Matcher * self = p->matcher;
+	unsigned int set = 0;
+	int negate = 0;
+
+	if (*p->pos == '^') {
+		negate = 1;
+		p->pos++;
+	}
+
+	/* a ']' right after the '[' is a literal */
+	int first = 1;
+
+	while (*p->pos && (first || *p->pos != ']')) {
+
+		unsigned char lo = *p->pos++;
+		first = 0;
+
+		if (lo == '[') {
+			/* character classes and collating elements are left to regcomp */
+			if (*p->pos == ':' || *p->pos == '.' || *p->pos == '=') {
+				p->error = 1;
+				return NULL;
+			}
+		}
+
+		if (*p->pos == '-' && p->pos[1] && p->pos[1] != ']') {
+			unsigned char hi = p->pos[1];
+			p->pos += 2;
+			for (int s = 0; s < STROKES_COUNT; ++s) {
+				unsigned char c = stroke_representations[s];
+				if (c >= lo && c <= hi) {
+					set |= 1u << s;
+				}
+			}
+		} else {
+			set |= symbol_set_of_char(self, lo);
+		}
+	}
+
+	if (*p->pos != ']') {
+		p->error = 1;
+		return NULL;
+	}
+	p->pos++;
+
+	if (negate) {
+		set = ~set & ((1u << STROKES_COUNT) - 1);
+	}
+
+	Node * node = node_new(NODE_SET, NULL, NULL);
+	node->set = set;
+	return node;
+}
+
+static Node * parse_atom(Parser * p) {
+
+	Node * node = NULL;
+	unsigned char c = *p->pos;
+
+	switch (c) {
+	case '(':
+		p->pos++;
+		node = parse_alternation(p);
+		if (p->error) {
+			node_free(node);
+			return NULL;
+		}
+		if (*p->pos != ')') {
+			p->error = 1;
+			node_free(node);
+			return NULL;
+		}
+		p->pos++;
+		return node;
+	case '[':
+		p->pos++;
+		return parse_bracket(p);
+	case '.':
+		p->pos++;
+		node = node_new(NODE_SET, NULL, NULL);
+		node->set = (1u << STROKES_COUNT) - 1;
+		return node;
+	case '\\':
+		p->pos++;
+		c = *p->pos;
+		if (!c) {
+			p->error = 1;
+			return NULL;
+		}
+		p->pos++;
+		node = node_new(NODE_SET, NULL, NULL);
+		node->set = symbol_set_of_char(p->matcher, c);
+		return node;
+	case '^':
+	case '$':
+	case '*':
+	case '+':
+	case '?':
+	case '{':
+		/* anchors and dangling operators are left to regcomp */
+		p->error = 1;
+		return NULL;
+	default:
+		p->pos++;
+		node = node_new(NODE_SET, NULL, NULL);
+		node->set = symbol_set_of_char(p->matcher, c);
+		return node;
+	}
+}
+
+static int parse_number(Parser * p) {
+	int n = -1;
+	while (*p->pos >= '0' && *p->pos <= '9') {
+		n = (n < 0 ? 0 : n * 10) + (*p->pos - '0');
+		if (n > MATCHER_MAX_REPEAT) {
+			p->error = 1;
+			return -1;
+		}
+		p->pos++;
+	}
+	return n;
+}
+
+static Node * parse_repeat(Parser * p) {
+
+	Node * node = parse_atom(p);
+
+	while (!p->error) {
+
+		char c = *p->pos;
+
+		if (c == '*') {
+			node = node_new(NODE_STAR, node, NULL);
+		} else if (c == '+') {
+			node = node_new(NODE_PLUS, node, NULL);
+		} else if (c == '?') {
+			node = node_new(NODE_QUEST, node, NULL);
+		} else if (c == '{') {
+			p->pos++;
+			int min = parse_number(p);
+			int max = min;
+			if (*p->pos == ',') {
+				p->pos++;
+				max = parse_number(p);
+			}
+			if (p->error || min < 0 || *p->pos != '}'
+					|| (max >= 0 && max < min)) {
+				p->error = 1;
+				break;
+			}
+			node = node_new(NODE_REPEAT, node, NULL);
+			node->min = min;
+			node->max = max;
+		} else {
+			break;
+		}
+		p->pos++;
+	}
+
+	if (p->error) {
+		node_free(node);
+		return NULL;
+	}
+
+	return node;
+}
+
+static Node * parse_concatenation(Parser * p) {
+
+	Node * node = NULL;
+
+	while (*p->pos && *p->pos != '|' && *p->pos != ')') {
+		Node * next = parse_repeat(p);
+		if (p->error) {
+			node_free(node);
+			return NULL;
+		}
+		node = node ? node_new(NODE_CAT, node, next) : next;
+	}
+
+	if (!node) {
+		node = node_new(NODE_EMPTY, NULL, NULL);
+	}
+
+	return node;
+}
+
+static Node * parse_alternation(Parser * p) {
+
+	Node * node = parse_concatenation(p);
+
+	while (!p->error && *p->pos == '|') {
+		p->pos++;
+		Node * next = parse_concatenation(p);
+		if (p->error) {
+			break;
+		}
+		node = node_new(NODE_ALT, node, next);
+	}
+
+	if (p->error) {
+		node_free(node);
+		return NULL;
+	}
+
+	return node;
+}
+
+static Node * parse_expression(Matcher * self, char * expression) {
+
+	Parser p;
+	p.pos = expression;
+	p.matcher = self;
+	p.error = 0;
+
+	Node * node = parse_alternation(&p);
+
+	if (!p.error && *p.pos != '\0') {
+		/* unbalanced ')' */
+		p.error = 1;
+	}
+
+	if (p.error) {
+		node_free(node);
+		return NULL;
+	}
+
+	return node;
+}
+
+static int nfa_add_state(Nfa * nfa, int consume, unsigned int set) {
+
+	if (nfa->state_count == nfa->state_size) {
+		nfa->state_size = nfa->state_size ? nfa->state_size * 2 : 256;
+		nfa->state_list = realloc(nfa->state_list,
+				sizeof(NfaState) * nfa->state_size);
+	}
+
+	NfaState * s = &nfa->state_list[nfa->state_count];
+	s->consume = consume;
+	s->set = set;
+	s->out = -1;
+	s->out1 = -1;
+	s->accept = -1;
+
+	return nfa->state_count++;
+}
+
+/* every fragment ends on a fresh epsilon state with no edges yet */
+static Fragment nfa_build(Nfa * nfa, Node * node) {
+
+	Fragment f, a, b;
+	int i;
+
+	switch (node->type) {
+	case NODE_EMPTY:
+		f.start = f.end = nfa_add_state(nfa, 0, 0);
+		break;
+	case NODE_SET:
+		f.start = nfa_add_state(nfa, 1, node->set);
+		f.end = nfa_add_state(nfa, 0, 0);
+		nfa->state_list[f.start].out = f.end;
+		break;
+	case NODE_CAT:
+		a = nfa_build(nfa, node->left);
+		b = nfa_build(nfa, node->right);
+		nfa->state_list[a.end].out = b.start;
+		f.start = a.start;
+		f.end = b.end;
+		break;
+	case NODE_ALT:
+		a = nfa_build(nfa, node->left);
+		b = nfa_build(nfa, node->right);
+		f.start = nfa_add_state(nfa, 0, 0);
+		f.end = nfa_add_state(nfa, 0, 0);
+		nfa->state_list[f.start].out = a.start;
+		nfa->state_list[f.start].out1 = b.start;
+		nfa->state_list[a.end].out = f.end;
+		nfa->state_list[b.end].out = f.end;
+		break;
+	case NODE_STAR:
+		a = nfa_build(nfa, node->left);
+		f.start = nfa_add_state(nfa, 0, 0);
+		f.end = nfa_add_state(nfa, 0, 0);
+		nfa->state_list[f.start].out = a.start;
+		nfa->state_list[f.start].out1 = f.end;
+		nfa->state_list[a.end].out = a.start;
+		nfa->state_list[a.end].out1 = f.end;
+		break;
+	case NODE_PLUS:
+		a = nfa_build(nfa, node->left);
+		f.start = a.start;
+		f.end = nfa_add_state(nfa, 0, 0);
+		nfa->state_list[a.end].out = a.start;
+		nfa->state_list[a.end].out1 = f.end;
+		break;
+	case NODE_QUEST:
+		a = nfa_build(nfa, node->left);
+		f.start = nfa_add_state(nfa, 0, 0);
+		f.end = nfa_add_state(nfa, 0, 0);
+		nfa->state_list[f.start].out = a.start;
+		nfa->state_list[f.start].out1 = f.end;
+		nfa->state_list[a.end].out = f.end;
+		break;
+	case NODE_REPEAT:
+		f.start = f.end = nfa_add_state(nfa, 0, 0);
+		for (i = 0; i < node->min; ++i) {
+			a = nfa_build(nfa, node->left);
+			nfa->state_list[f.end].out = a.start;
+			f.end = a.end;
+		}
+		if (node->max < 0) {
+			Node star = { NODE_STAR, 0, 0, 0, node->left, NULL };
+			a = nfa_build(nfa, &star);
+			nfa->state_list[f.end].out = a.start;
+			f.end = a.end;
+		} else {
+			Node quest = { NODE_QUEST, 0, 0, 0, node->left, NULL };
+			for (i = node->min; i < node->max; ++i) {
+				a = nfa_build(nfa, &quest);
+				nfa->state_list[f.end].out = a.start;
+				f.end = a.end;
+			}
+		}
+		break;
+	default:
+		assert(0);
+	}
+
+	return f;
+}
+
+/*
+ * Sets of NFA states, used while building the DFA.
+ */
+
+typedef struct subset_builder_ {
+	Nfa * nfa;
+	int words;
+	uint64_t * sets;
+	int set_count;
+	int * hash_table;
+	int hash_size;
+	int * stack;
+} SubsetBuilder;
+
+static void subset_add_closure(SubsetBuilder * b, uint64_t * set, int state) {
+
+	int top = 0;
+
+	if (set[state / 64] & (1ull << (state % 64))) {
+		return;
+	}
+	set[state / 64] |= 1ull << (state % 64);
+	b->stack[top++] = state;
+
+	while (top) {
+		NfaState * s = &b->nfa->state_list[b->stack[--top]];
+		if (s->consume) {
+			continue;
+		}
+		int outs[2] = { s->out, s->out1 };
+		for (int i = 0; i < 2; ++i) {
+			int o = outs[i];
+			if (o >= 0 && !(set[o / 64] & (1ull << (o % 64)))) {
+				set[o / 64] |= 1ull << (o % 64);
+				b->stack[top++] = o;
+			}
+		}
+	}
+}
+
+static unsigned int subset_hash(SubsetBuilder * b, uint64_t * set) {
+	uint64_t h = 14695981039346656037ull;
+	for (int i = 0; i < b->words; ++i) {
+		h = (h ^ set[i]) * 1099511628211ull;
+	}
+	return (unsigned int) (h ^ (h >> 32));
+}
+
+/*
+ * Returns the index of the DFA state for 'set', adding it if it's new.
+ * Returns -1 when the automaton grows past MATCHER_MAX_STATES.
+ */
+static int subset_intern(SubsetBuilder * b, uint64_t * set) {
+
+	unsigned int slot = subset_hash(b, set) & (b->hash_size - 1);
+
+	while (b->hash_table[slot] >= 0) {
+		int index = b->hash_table[slot];
+		if (memcmp(&b->sets[(size_t) index * b->words], set,
+				sizeof(uint64_t) * b->words) == 0) {
+			return index;
+		}
+		slot = (slot + 1) & (b->hash_size - 1);
+	}
+
+	if (b->set_count == MATCHER_MAX_STATES) {
+		return -1;
+	}
+
+	int index = b->set_count++;
+	memcpy(&b->sets[(size_t) index * b->words], set,
+			sizeof(uint64_t) * b->words);
+	b->hash_table[slot] = index;
+
+	return index;
+}
+
+/*
+ * A movement is viable on a state if some accepting state is reachable from
+ * it. Iterate until the sets stop growing.
+ */
+static void matcher_build_viable(Matcher * self) {
+
+	int words = self->accept_words;
+
+	self->viable = malloc(
+			sizeof(unsigned int) * self->state_count * words);
+	memcpy(self->viable, self->accept,
+			sizeof(unsigned int) * self->state_count * words);
+
+	int changed = 1;
+
+	while (changed) {
+
+		changed = 0;
+
+		for (int d = self->state_count - 1; d >= 0; --d) {
+
+			unsigned int * viable = &self->viable[d * words];
+
+			for (int symbol = 0; symbol < STROKES_COUNT; ++symbol) {
+
+				int next = self->transitions[d * STROKES_COUNT + symbol];
+				unsigned int * next_viable = &self->viable[next * words];
+
+				for (int w = 0; w < words; ++w) {
+					if (next_viable[w] & ~viable[w]) {
+						viable[w] |= next_viable[w];
+						changed = 1;
+					}
+				}
+			}
+		}
+	}
+}
+
+static int matcher_build_dfa(Matcher * self, Nfa * nfa, int * start_list,
+		int start_count) {
+
+	SubsetBuilder b;
+	b.nfa = nfa;
+	b.words = (nfa->state_count + 63) / 64;
+	b.set_count = 0;
+	b.hash_size = MATCHER_MAX_STATES * 2;
+	b.sets = calloc((size_t) MATCHER_MAX_STATES * b.words, sizeof(uint64_t));
+	b.hash_table = malloc(sizeof(int) * b.hash_size);
+	memset(b.hash_table, -1, sizeof(int) * b.hash_size);
+	b.stack = malloc(sizeof(int) * nfa->state_count);
+
+	uint64_t * set = calloc(b.words, sizeof(uint64_t));
+
+	self->transitions = malloc(
+			sizeof(int) * MATCHER_MAX_STATES * STROKES_COUNT);
+
+	int err = 0;
+
+	/* the empty set is the dead state */
+	subset_intern(&b, set);
+
+	for (int i = 0; i < start_count; ++i) {
+		subset_add_closure(&b, set, start_list[i]);
+	}
+	subset_intern(&b, set);
+
+	for (int d = 0; d < b.set_count && !err; ++d) {
+
+		for (int symbol = 0; symbol < STROKES_COUNT; ++symbol) {
+
+			uint64_t * from = &b.sets[(size_t) d * b.words];
+			memset(set, 0, sizeof(uint64_t) * b.words);
+
+			for (int w = 0; w < b.words; ++w) {
+				uint64_t bits = from[w];
+				while (bits) {
+					int s = w * 64 + __builtin_ctzll(bits);
+					bits &= bits - 1;
+					NfaState * state = &nfa->state_list[s];
+					if (state->consume && (state->set & (1u << symbol))) {
+						subset_add_closure(&b, set, state->out);
+					}
+				}
+			}
+
+			int next = subset_intern(&b, set);
+			if (next < 0) {
+				err = 1;
+				break;
+			}
+			self->transitions[d * STROKES_COUNT + symbol] = next;
+		}
+	}
+
+	if (!err) {
+
+		self->state_count = b.set_count;
+		self->transitions = realloc(self->transitions,
+				sizeof(int) * self->state_count * STROKES_COUNT);
+		self->accept = calloc((size_t) self->state_count * self->accept_words,
+				sizeof(unsigned int));
+
+		for (int d = 0; d < self->state_count; ++d) {
+			uint64_t * from = &b.sets[(size_t) d * b.words];
+			unsigned int * accept = &self->accept[d * self->accept_words];
+			for (int w = 0; w < b.words; ++w) {
+				uint64_t bits = from[w];
+				while (bits) {
+					int s = w * 64 + __builtin_ctzll(bits);
+					bits &= bits - 1;
+					int id = nfa->state_list[s].accept;
+					if (id >= 0) {
+						accept[id / 32] |= 1u << (id % 32);
+					}
+				}
+			}
+		}
+	}
+
+	if (!err) {
+		matcher_build_viable(self);
+	}
+
+	free(set);
+	free(b.stack);
+	free(b.hash_table);
+	free(b.sets);
+
+	return err;
+}
+
+static Matcher * matcher_alloc(int movement_count) {
+
+	Matcher * self = malloc(sizeof(Matcher));
+	bzero(self, sizeof(Matcher));
+
+	self->movement_count = movement_count;
+	self->accept_words = movement_count / 32 + 1;
+	self->match_buffer = calloc(self->accept_words, sizeof(unsigned int));
+	self->fallback_list = malloc(sizeof(Movement *) * (movement_count + 1));
+
+	memset(self->stroke_index, -1, sizeof(self->stroke_index));
+	for (int s = 0; s < STROKES_COUNT; ++s) {
+		self->stroke_index[(unsigned char) stroke_representations[s]] = s;
+	}
+
+	return self;
+}
+
+/*
+ * A matcher on tables built before by matcher_new, for a configuration with
+ * the same movements. The tables are used as they are, and are not freed by
+ * matcher_free.
+ */
+Matcher * matcher_new_from_tables(Movement * movement_list, int movement_count,
+		int state_count, int * transitions, unsigned int * accept,
+		unsigned int * viable, const int * fallback_ids, int fallback_count) {
+
+	assert(fallback_count <= movement_count);
+
+	Matcher * self = matcher_alloc(movement_count);
+
+	self->state_count = state_count;
+	self->transitions = transitions;
+	self->accept = accept;
+	self->viable = viable;
+	self->borrowed = 1;
+
+	for (int i = 0; i < fallback_count; ++i) {
+		assert(fallback_ids[i] >= 0 && fallback_ids[i] < movement_count);
+		self->fallback_list[self->fallback_count++] =
+				&movement_list[fallback_ids[i]];
+	}
+
+	return self;
+}
+
+Matcher * matcher_new(Movement * movement_list, int movement_count) {
+
+	Matcher * self = matcher_alloc(movement_count);
+
+	Nfa nfa;
+	bzero(&nfa, sizeof(Nfa));
+
+	int * start_list = malloc(sizeof(int) * (movement_count + 1));
+	int start_count = 0;
+
+	/* keeps the start state apart from the dead state on empty configurations */
+	start_list[start_count++] = nfa_add_state(&nfa, 0, 0);
+
+	for (int i = 0; i < movement_count; ++i) {
+
+		Movement * movement = &movement_list[i];
+
+		assert(movement->id == i);
+
+		/* invalid expressions never match */
+		if (!movement->valid) {
+			continue;
+		}
+
+		Node * node = parse_expression(self, movement->expression);
+
+		if (!node) {
+			self->fallback_list[self->fallback_count++] = movement;
+			continue;
+		}
+
+		Fragment f = nfa_build(&nfa, node);
+		int accept = nfa_add_state(&nfa, 0, 0);
+		nfa.state_list[accept].accept = movement->id;
+		nfa.state_list[f.end].out = accept;
+		start_list[start_count++] = f.start;
+
+		node_free(node);
+	}
+
+	int err = matcher_build_dfa(self, &nfa, start_list, start_count);
+
+	free(start_list);
+	free(nfa.state_list);
+
+	if (err) {
+		matcher_free(self);
+		return NULL;
+	}
+
+	return self;
+}
+
+void matcher_free(Matcher * self) {
+
+	if (!self) {
+		return;
+	}
+
+	if (!self->borrowed) {
+		free(self->transitions);
+		free(self->accept);
+		free(self->viable);
+	}
+	free(self->fallback_list);
+	free(self->match_buffer);
+	free(self);
+}
+
+int matcher_step(Matcher * self, int state, char stroke) {
+
+	int symbol = self->stroke_index[(unsigned char) stroke];
+
+	if (symbol < 0) {
+		return MATCHER_DEAD_STATE;
+	}
+
+	return self->transitions[state * STROKES_COUNT + symbol];
+}
+
+int matcher_run(Matcher * self, int state, char * sequence) {
+
+	assert(self);
+	assert(sequence);
+
+	for (char * c = sequence; *c && state != MATCHER_DEAD_STATE; ++c) {
+		state = matcher_step(self, state, *c);
+	}
+
+	return state;
+}
+
+/*
+ * Returns the set of movement ids that fully match 'sequence', given the
+ * state reached after feeding it to the automaton.
+ * The set is owned by the matcher and is overwritten on the next call.
+ */
+const unsigned int * matcher_match_state(Matcher * self, int state,
+		char * sequence) {
+
+	assert(self);
+	assert(sequence);
+	assert(state >= 0 && state < self->state_count);
+
+	memcpy(self->match_buffer, &self->accept[state * self->accept_words],
+			sizeof(unsigned int) * self->accept_words);
+
+	for (int i = 0; i < self->fallback_count; ++i) {
+		Movement * movement = self->fallback_list[i];
+		if (regexec(movement->expression_compiled, sequence, 0,
+				(regmatch_t *) NULL, 0) == 0) {
+			self->match_buffer[movement->id / 32] |= 1u << (movement->id % 32);
+		}
+	}
+
+	return self->match_buffer;
+}
+
+const unsigned int * matcher_match(Matcher * self, char * sequence) {
+
+	assert(self);
+	assert(sequence);
+
+	int state = matcher_run(self, MATCHER_START_STATE, sequence);
+
+	return matcher_match_state(self, state, sequence);
+}
+
+/*
+ * Movements that may still match if more strokes are added to a sequence on
+ * 'state'. Movements matched by regexec are not included.
+ */
+const unsigned int * matcher_get_viable(Matcher * self, int state) {
+
+	assert(self);
+	assert(state >= 0 && state < self->state_count);
+
+	return &self->viable[state * self->accept_words];
+}
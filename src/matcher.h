@@ -0,0 +1,76 @@
+/*
+ Copyright 2016 Lucas Augusto Deters
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2, or (at your option)
+ any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ one line to give the program's name and an idea of what it does.
+ */
+
+#ifndef MYGESTURES_MATCHER_H_
+#define MYGESTURES_MATCHER_H_
+
+#include "configuration.h"
+
+/* upper bound for the automaton. bigger configurations fall back to regexec */
+#define MATCHER_MAX_STATES 8192
+
+#define MATCHER_DEAD_STATE 0
+#define MATCHER_START_STATE 1
+
+/* test if movement 'id' is set on a match set returned by the matcher */
+#define MATCHER_TEST(set, id) (((set)[(id) / 32] >> ((id) % 32)) & 1)
+
+/*
+ * A DFA built from the expressions of every movement in a configuration.
+ *
+ * Each state has one transition per stroke (see enum STROKES) and a set of
+ * movement ids that accept a sequence ending on that state.
+ */
+typedef struct matcher_ {
+
+	int movement_count;
+	int accept_words;
+
+	/* maps a stroke char to its enum STROKES value, -1 if it isn't a stroke */
+	signed char stroke_index[256];
+
+	int state_count;
+	int * transitions;
+	unsigned int * accept;
+
+	/* movements that can still be completed from each state */
+	unsigned int * viable;
+
+	/* movements whose expression the automaton can't represent */
+	Movement ** fallback_list;
+	int fallback_count;
+
+	unsigned int * match_buffer;
+
+	/* the tables above belong to someone else, see matcher_new_from_tables */
+	int borrowed;
+
+} Matcher;
+
+Matcher * matcher_new(Movement * movement_list, int movement_count);
+Matcher * matcher_new_from_tables(Movement * movement_list, int movement_count,
+		int state_count, int * transitions, unsigned int * accept,
+		unsigned int * viable, const int * fallback_ids, int fallback_count);
+void matcher_free(Matcher * self);
+
+int matcher_step(Matcher * self, int state, char stroke);
+int matcher_run(Matcher * self, int state, char * sequence);
+const unsigned int * matcher_match(Matcher * self, char * sequence);
+const unsigned int * matcher_match_state(Matcher * self, int state,
+		char * sequence);
+const unsigned int * matcher_get_viable(Matcher * self, int state);
+
+#endif
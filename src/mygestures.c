@@ -35,6 +35,7 @@
 #include "grabbing.h"
 #include "configuration.h"
 #include "configuration_parser.h"
+#include "configuration_check.h"
 
 uint MAX_GRABBED_DEVICES = 10;
 
@@ -58,7 +59,18 @@ static void mygestures_usage(Mygestures *self)
 	printf(" -v, --visual               : Don't paint the gesture on screen.\n");
 	printf(" -c, --color                : Brush color.\n");
 	printf("                              Default: blue\n");
-	printf("                              Options: yellow, white, red, green, purple, blue\n");
+	printf("                              Options: yellow, white, red, green, purple, blue,\n");
+	printf("                                       #rrggbb or #rrggbbaa\n");
+	printf(" -w, --brush-width <PIXELS> : Brush width, scaled by Xft.dpi on HiDPI screens.\n");
+	printf("                              Default: 5, at most 256\n");
+	printf(" -o, --overlay              : Draw the gesture on a transparent window.\n");
+	printf("                              Needs a compositing manager.\n");
+	printf(" -r, --raster               : Draw the overlay in memory, send it with MIT-SHM.\n");
+	printf("                              Implies --overlay.\n");
+	printf(" -f, --fade <MS>            : Fade the gesture out in MS milliseconds.\n");
+	printf("                              Needs --overlay.\n");
+	printf(" -k, --check                : Check the configuration file and exit.\n");
+	printf(" -V, --verbose              : Print what drawing and matching each gesture cost.\n");
 	printf(" -h, --help                 : Help\n");
 	printf(" -m, --multitouch           : Multitouch mode on some synaptic touchpads.\n");
 	printf("                              It depends on this patched synaptics driver to work:\n");
@@ -71,7 +83,7 @@ Mygestures *mygestures_new()
 	Mygestures *self = malloc(sizeof(Mygestures));
 	bzero(self, sizeof(Mygestures));
 
-	self->device_list = malloc(sizeof(uint) * MAX_GRABBED_DEVICES);
+	self->device_list = malloc(sizeof(char *) * MAX_GRABBED_DEVICES);
 	self->gestures_configuration = configuration_new();
 
 	return self;
@@ -91,37 +103,114 @@ static void mygestures_load_configuration(Mygestures *self)
 	}
 }
 
-static void mygestures_grab_device(Mygestures *self, char *device_name)
+/*
+ * Load the configuration from the XML, ignoring the cache, report what is
+ * wrong with it and exit. Nothing is grabbed.
+ */
+static void mygestures_check_configuration(Mygestures *self)
 {
+	char *filename = self->custom_config_file;
 
-	int p = fork();
-
-	if (p != 0)
+	if (!filename)
 	{
+		filename = configuration_get_default_filename();
+	}
 
-		/* We are in the forked thread. Start grabbing a device */
+	printf("Checking '%s'\n", filename);
 
-		printf("Listening to device '%s'\n\n", device_name);
+	int err = configuration_load_uncached(self->gestures_configuration,
+										  filename);
+	int problems = 0;
 
-		alloc_shared_memory(device_name, self->trigger_button);
+	if (!err)
+	{
+		problems = configuration_check(self->gestures_configuration);
+	}
 
-		Grabber *grabber = grabber_new(device_name, self->trigger_button);
+	if (filename != self->custom_config_file)
+	{
+		free(filename);
+	}
 
-		grabber_set_brush_color(grabber, self->brush_color);
+	configuration_unref(self->gestures_configuration);
+	self->gestures_configuration = NULL;
 
-		send_kill_message(device_name);
+	exit(err || problems ? 1 : 0);
+}
 
-		signal(SIGINT, on_interrupt);
-		signal(SIGKILL, on_kill);
+/*
+ * Name the instance after every grabbed device, so running mygestures again
+ * with the same devices replaces this process.
+ */
+static char *mygestures_instance_name(char **device_list, int device_count)
+{
+	size_t length = 1;
 
-		if (self->list_devices_flag)
-		{
-			grabber_list_devices(grabber);
-		}
-		else
+	for (int i = 0; i < device_count; ++i)
+	{
+		length += strlen(device_list[i]) + 1;
+	}
+
+	char *name = malloc(length);
+	name[0] = '\0';
+
+	for (int i = 0; i < device_count; ++i)
+	{
+		if (i)
 		{
-			grabber_loop(grabber, self->gestures_configuration);
+			strcat(name, ",");
 		}
+		strcat(name, device_list[i]);
+	}
+
+	return name;
+}
+
+static void mygestures_grab_devices(Mygestures *self, char **device_list,
+									int device_count)
+{
+
+	/* All devices are grabbed by this process, on a single X connection */
+
+	char *instance_name = mygestures_instance_name(device_list, device_count);
+
+	alloc_shared_memory(instance_name, self->trigger_button);
+
+	Grabber *grabber = grabber_new(self->trigger_button);
+
+	for (int i = 0; i < device_count; ++i)
+	{
+		grabber_add_device(grabber, device_list[i]);
+	}
+
+	grabber_set_brush_color(grabber, self->brush_color);
+	grabber_set_brush_width(grabber, self->brush_width);
+	grabber_set_overlay(grabber, self->overlay || self->raster);
+	grabber_set_raster(grabber, self->raster);
+	grabber_set_fade(grabber, self->fade);
+	grabber_set_verbose(grabber, self->verbose);
+
+	send_kill_message(instance_name);
+
+	free(instance_name);
+
+	signal(SIGINT, on_interrupt);
+	signal(SIGTERM, on_interrupt);
+	signal(SIGKILL, on_kill);
+
+	if (self->list_devices_flag)
+	{
+		grabber_list_devices(grabber);
+	}
+	else
+	{
+		grabber_loop(grabber, self->gestures_configuration);
+
+		grabber_finalize(grabber);
+		release_instance();
+
+		configuration_unref(self->gestures_configuration);
+		self->gestures_configuration = NULL;
 	}
 }
 
@@ -136,6 +225,11 @@ void mygestures_run(Mygestures *self)
 		exit(0);
 	}
 
+	if (self->check_flag)
+	{
+		mygestures_check_configuration(self);
+	}
+
 	/*
 	 * Will not load configuration if it is only listing the devices.
 	 */
@@ -147,7 +241,8 @@ void mygestures_run(Mygestures *self)
 	if (self->multitouch)
 	{
 		printf("Starting in multitouch mode.\n");
-		mygestures_grab_device(self, "synaptics");
+		char *synaptics[] = {"synaptics"};
+		mygestures_grab_devices(self, synaptics, 1);
 	}
 	else
 	{
@@ -157,19 +252,18 @@ void mygestures_run(Mygestures *self)
 			/*
 		 * Start grabbing any device passed via argument flags.
 		 */
-			for (int i = 0; i < self->device_count; ++i)
-			{
-				mygestures_grab_device(self, self->device_list[i]);
-			}
+			mygestures_grab_devices(self, self->device_list,
+									self->device_count);
 		}
 		else
 		{
 
 			printf("Selecting default xinput device.\n");
-			mygestures_grab_device(self, "Virtual Core Pointer");
 			/*
 		 * If there where no devices in the argument flags, then grab the default devices.
 		 */
+			char *default_device[] = {"Virtual Core Pointer"};
+			mygestures_grab_devices(self, default_device, 1);
 		}
 	}
 }
@@ -7,15 +7,21 @@
 typedef struct mygestures_
 {
 	int help_flag;
+	int check_flag;
 	int trigger_button;
 	int multitouch;
 	int list_devices_flag;
+	int overlay;
+	int raster;
+	int fade;
+	int verbose;
 
 	char *custom_config_file;
 
 	int device_count;
 	char **device_list;
 	char *brush_color;
+	int brush_width;
 
 	Configuration *gestures_configuration;
 